@@ -0,0 +1,325 @@
+/**
+ * @file banded_engine.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Span-limited DP fill that only keeps the band j - i <= span
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+#include "rna_folding.hh"
+#include "simd_kernels.hh"
+
+/**
+ * @brief Cells (i, j) of a square matrix with i <= j <= i + span, stored row
+ * after row. Row i holds the columns i..i + span next to each other, so that
+ * the whole band takes n * (span + 1) cells.
+ *
+ * @tparam Cell type of a single cell
+ */
+template <typename Cell = int>
+class BandedMatrix {
+   private:
+    size_t n;
+    size_t band;
+    std::vector<Cell> cells;
+
+   public:
+    /**
+     * @brief Construct an empty matrix
+     *
+     */
+    BandedMatrix() : n(0), band(0) {}
+
+    /**
+     * @brief Construct a new n x n matrix keeping the cells with
+     * j - i <= span, every one set to zero
+     *
+     * @param n
+     * @param span
+     */
+    BandedMatrix(size_t n, size_t span)
+        : n(n), band(span), cells(n * (span + 1), 0) {}
+
+    /**
+     * @brief Position of cell (i, j) inside the band, requires
+     * i <= j <= i + span
+     *
+     * @param i
+     * @param j
+     * @return size_t
+     */
+    size_t index(size_t i, size_t j) const { return i * band + j; }
+
+    /**
+     * @brief Access cell (i, j), requires i <= j <= i + span
+     *
+     * @param i
+     * @param j
+     * @return Cell&
+     */
+    Cell& operator()(size_t i, size_t j) { return cells[index(i, j)]; }
+
+    /**
+     * @brief Access cell (i, j), requires i <= j <= i + span
+     *
+     * @param i
+     * @param j
+     * @return const Cell&
+     */
+    const Cell& operator()(size_t i, size_t j) const {
+        return cells[index(i, j)];
+    }
+
+    /**
+     * @brief Read cell (i, j), requires j <= i + span. Cells below the
+     * diagonal read as zero, like in TriangularMatrix.
+     *
+     * @param i
+     * @param j
+     * @return Cell
+     */
+    Cell at(size_t i, size_t j) const {
+        return i > j ? Cell(0) : cells[index(i, j)];
+    }
+
+    /**
+     * @brief Pointer to cell (i, i), the columns i..i + span of row i follow
+     * it
+     *
+     * @param i
+     * @return const Cell*
+     */
+    const Cell* row(size_t i) const { return cells.data() + index(i, i); }
+
+    /**
+     * @brief Number of rows (and columns) of the matrix
+     *
+     * @return size_t
+     */
+    size_t size() const { return n; }
+
+    /**
+     * @brief Largest j - i kept in the band
+     *
+     * @return size_t
+     */
+    size_t span() const { return band; }
+
+    /**
+     * @brief Number of cells actually stored
+     *
+     * @return size_t
+     */
+    size_t cell_count() const { return cells.size(); }
+};
+
+/**
+ * @brief Same cells as BandedMatrix, but stored column after column so that
+ * column j holds the rows j - span..j next to each other. Kept next to the
+ * banded DP matrix as a transposed mirror, like ColumnTriangularMatrix.
+ *
+ * @tparam Cell type of a single cell
+ */
+template <typename Cell = int>
+class ColumnBandedMatrix {
+   private:
+    size_t n;
+    size_t band;
+    std::vector<Cell> cells;
+
+   public:
+    /**
+     * @brief Construct an empty matrix
+     *
+     */
+    ColumnBandedMatrix() : n(0), band(0) {}
+
+    /**
+     * @brief Construct a new n x n matrix keeping the cells with
+     * j - i <= span, every one set to zero
+     *
+     * @param n
+     * @param span
+     */
+    ColumnBandedMatrix(size_t n, size_t span)
+        : n(n), band(span), cells(n * (span + 1), 0) {}
+
+    /**
+     * @brief Position of cell (i, j) inside the band, requires
+     * i <= j <= i + span
+     *
+     * @param i
+     * @param j
+     * @return size_t
+     */
+    size_t index(size_t i, size_t j) const { return (j + 1) * band + i; }
+
+    /**
+     * @brief Access cell (i, j), requires i <= j <= i + span
+     *
+     * @param i
+     * @param j
+     * @return Cell&
+     */
+    Cell& operator()(size_t i, size_t j) { return cells[index(i, j)]; }
+
+    /**
+     * @brief Access cell (i, j), requires i <= j <= i + span
+     *
+     * @param i
+     * @param j
+     * @return const Cell&
+     */
+    const Cell& operator()(size_t i, size_t j) const {
+        return cells[index(i, j)];
+    }
+
+    /**
+     * @brief Pointer to where cell (0, j) would be. Only the rows
+     * j - span..j that follow it may be read.
+     *
+     * @param j
+     * @return const Cell*
+     */
+    const Cell* column(size_t j) const { return cells.data() + index(0, j); }
+
+    /**
+     * @brief Number of rows (and columns) of the matrix
+     *
+     * @return size_t
+     */
+    size_t size() const { return n; }
+};
+
+/**
+ * @brief Span-limited version of create_matrix: only pairs with j - i <= span
+ * are allowed, so only that band of the matrix is stored and computed. Takes
+ * O(n * span^2) time and O(n * span) memory. Rows are filled from the last
+ * one up, which keeps the span + 1 rows being read in cache.
+ *
+ * Cell (i, j) of the band holds the same value as in create_matrix with the
+ * pairs limited to the span. Combine it with banded_prefix_scores for the
+ * score of the whole sequence.
+ *
+ * @tparam Cell cell type, see with_cell_type for picking the narrowest one
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param span largest allowed j - i of a pair
+ * @return BandedMatrix<Cell>
+ */
+template <typename Cell = int>
+BandedMatrix<Cell> create_matrix_banded(const Sequence& rna_sequence,
+                                        const int& minimal_loop_length,
+                                        size_t span) {
+    const size_t n = rna_sequence.size();
+    if (n == 0) {
+        return BandedMatrix<Cell>();
+    }
+    span = std::min(span, n - 1);
+    check_cell_type<Cell>(span + 1);
+
+    BandedMatrix<Cell> dp(n, span);
+    ColumnBandedMatrix<Cell> columns(n, span);
+
+    for (size_t i = n; i-- > 0;) {
+        const size_t j_end = std::min(n, i + span + 1);
+        for (size_t j = i + 1; j < j_end; j++) {
+            Cell value = 0;
+            if (j - i > minimal_loop_length) {
+                value = std::max(
+                    {dp(i + 1, j), dp(i, j - 1),
+                     Cell(dp.at(i + 1, j - 1) + rna_sequence.can_pair(i, j)),
+                     max_plus(dp.row(i), columns.column(j) + i + 1, j - i)});
+            }
+            dp(i, j) = value;
+            columns(i, j) = value;
+        }
+    }
+
+    return dp;
+}
+
+/**
+ * @brief Best score of every prefix of the sequence with the pairs limited to
+ * the span of dp. prefix[j + 1] is either prefix[j], with j unpaired, or
+ * prefix[i] + dp(i, j) for some i within the span. O(n * span).
+ *
+ * @tparam Cell
+ * @param dp
+ * @return std::vector<int> n + 1 scores, the last one is the whole sequence
+ */
+template <typename Cell>
+std::vector<int> banded_prefix_scores(const BandedMatrix<Cell>& dp) {
+    const size_t n = dp.size();
+    std::vector<int> prefix(n + 1, 0);
+    for (size_t j = 0; j < n; j++) {
+        int best = prefix[j];
+        for (size_t i = j - std::min(j, dp.span()); i < j; i++) {
+            best = std::max(best, prefix[i] + int(dp(i, j)));
+        }
+        prefix[j + 1] = best;
+    }
+    return prefix;
+}
+
+/**
+ * @brief Function to traceback the bonds structure of the whole sequence from
+ * a banded matrix and its prefix scores. The prefix scores are walked back to
+ * find the independent blocks, each of which is traced back inside the band.
+ *
+ * @tparam Cell
+ * @param dp
+ * @param prefix result of banded_prefix_scores(dp)
+ * @param rna
+ * @param fold
+ */
+template <typename Cell>
+void traceback_banded(const BandedMatrix<Cell>& dp,
+                      const std::vector<int>& prefix, const Sequence& rna,
+                      std::vector<std::pair<int, int>>& fold) {
+    size_t j = dp.size();
+    while (j > 0) {
+        if (prefix[j] == prefix[j - 1]) {
+            j--;
+            continue;
+        }
+        size_t i = j - 1 - std::min(j - 1, dp.span());
+        while (prefix[i] + int(dp(i, j - 1)) != prefix[j]) {
+            i++;
+        }
+        traceback(dp, rna, fold, i, j - 1);
+        j = i;
+    }
+}
+
+/**
+ * @brief Function to calculate number of bonds (theoretical) in the RNA when
+ * no pair may span more than span nucleotides. The matrix uses the narrowest
+ * cell type that can hold the score of one span.
+ *
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param span largest allowed j - i of a pair
+ * @return int
+ */
+int rna_score_banded(const Sequence& rna_sequence,
+                     const int& minimal_loop_length, size_t span) {
+    if (rna_sequence.empty()) {
+        return 0;
+    }
+    const size_t band = std::min(span, rna_sequence.size() - 1);
+    return with_cell_type(band + 1, [&](auto cell) {
+        using Cell = decltype(cell);
+        BandedMatrix<Cell> dp =
+            create_matrix_banded<Cell>(rna_sequence, minimal_loop_length, span);
+        return banded_prefix_scores(dp).back();
+    });
+}
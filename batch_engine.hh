@@ -0,0 +1,226 @@
+/**
+ * @file batch_engine.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief DP fill of many short sequences at once, one sequence per SIMD lane
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+#include "rna_folding.hh"
+#include "sequence.hh"
+#include "simd_kernels.hh"
+
+/**
+ * @brief Score and, if asked for, dot-bracket structure of one sequence of a
+ * batch
+ *
+ */
+struct BatchFold {
+    int score;
+    std::string structure;
+};
+
+/**
+ * @brief DP matrices of a group of Lanes sequences stored structure-of-arrays:
+ * every cell (i, j) is Lanes consecutive values, one per sequence, so that
+ * the same cell of all sequences is computed by the same vector
+ * instructions. Shorter sequences of the group are padded with unpairable
+ * positions, which leaves the cells of the real nucleotides unchanged. The
+ * storage is kept between groups, so a batch allocates only when the group
+ * length grows.
+ *
+ * @tparam Cell type of a single cell
+ * @tparam Lanes sequences per group
+ */
+template <typename Cell, size_t Lanes>
+class BatchMatrix {
+   private:
+    size_t n = 0;
+    std::vector<Cell> rows;         // row-major triangle, Lanes per cell
+    std::vector<Cell> columns;      // column-major mirror, Lanes per cell
+    std::vector<uint8_t> bases;     // one-hot nucleotide of (i, lane), 0 if N
+    std::vector<uint8_t> partners;  // one-hot nucleotides pairing with it
+
+    size_t row_index(size_t i, size_t j) const {
+        return (i * (2 * n - i + 1) / 2 + (j - i)) * Lanes;
+    }
+
+    size_t column_index(size_t i, size_t j) const {
+        return (j * (j + 1) / 2 + i) * Lanes;
+    }
+
+   public:
+    /**
+     * @brief View of one lane, with the at() traceback expects
+     *
+     */
+    struct Lane {
+        const BatchMatrix& matrix;
+        size_t lane;
+
+        Cell at(size_t i, size_t j) const {
+            return i > j ? Cell(0)
+                         : matrix.rows[matrix.row_index(i, j) + lane];
+        }
+    };
+
+    /**
+     * @brief Fills the matrices of up to Lanes sequences, padded to the
+     * longest of them
+     *
+     * @param group
+     * @param minimal_loop_length
+     */
+    void fill(const std::vector<const Sequence*>& group,
+              const int& minimal_loop_length) {
+        n = 0;
+        for (const Sequence* rna_sequence : group) {
+            n = std::max(n, rna_sequence->size());
+        }
+        const size_t cells = n * (n + 1) / 2 * Lanes;
+        rows.assign(cells, 0);
+        columns.assign(cells, 0);
+
+        // A, C, G, U as 1, 2, 4, 8, so two lanes pair if base & partner != 0
+        static constexpr uint8_t complement[4] = {8, 4, 2, 1};
+        bases.assign(n * Lanes, 0);
+        partners.assign(n * Lanes, 0);
+        for (size_t lane = 0; lane < group.size(); lane++) {
+            const Sequence& rna_sequence = *group[lane];
+            for (size_t i = 0; i < rna_sequence.size(); i++) {
+                if (rna_sequence.is_pairable(i)) {
+                    bases[i * Lanes + lane] = 1 << rna_sequence.code(i);
+                    partners[i * Lanes + lane] =
+                        complement[rna_sequence.code(i)];
+                }
+            }
+        }
+
+        for (size_t k = minimal_loop_length + 1; k < n; k++) {
+            for (size_t i = 0; i + k < n; i++) {
+                fill_cell(i, i + k);
+            }
+        }
+    }
+
+    /**
+     * @brief Computes cell (i, j) of every lane, with the rules of fill_cell
+     *
+     * @param i
+     * @param j
+     */
+    void fill_cell(size_t i, size_t j) {
+        const Cell* skip_left = rows.data() + row_index(i + 1, j);
+        const Cell* skip_right = rows.data() + row_index(i, j - 1);
+        const Cell* inner = rows.data() + row_index(i + 1, j - 1);
+        const uint8_t* base = bases.data() + i * Lanes;
+        const uint8_t* partner = partners.data() + j * Lanes;
+
+        Cell best[Lanes];
+        for (size_t lane = 0; lane < Lanes; lane++) {
+            const Cell closed =
+                inner[lane] + Cell((base[lane] & partner[lane]) != 0);
+            best[lane] =
+                std::max(std::max(skip_left[lane], skip_right[lane]), closed);
+        }
+
+        // Splits (i, t) + (t + 1, j); t = i and t = j - 1 are the skips above
+        const Cell* row = rows.data() + row_index(i, i);
+        const Cell* column = columns.data() + column_index(0, j);
+        for (size_t t = i + 1; t + 1 < j; t++) {
+            const Cell* left = row + (t - i) * Lanes;
+            const Cell* right = column + (t + 1) * Lanes;
+            for (size_t lane = 0; lane < Lanes; lane++) {
+                best[lane] = std::max(best[lane], Cell(left[lane] + right[lane]));
+            }
+        }
+
+        std::copy(best, best + Lanes, rows.data() + row_index(i, j));
+        std::copy(best, best + Lanes, columns.data() + column_index(i, j));
+    }
+
+    /**
+     * @brief Cell (i, j) of one lane
+     *
+     * @param lane
+     * @param i
+     * @param j
+     * @return Cell
+     */
+    Cell at(size_t lane, size_t i, size_t j) const {
+        return Lane{*this, lane}.at(i, j);
+    }
+};
+
+/**
+ * @brief Folds a batch of short sequences, such as miRNA precursors, far
+ * faster than one create_matrix per sequence. The sequences are sorted by
+ * length and taken in groups of as many as fit in a 256-bit vector of the
+ * cell type (32 below 512 nucleotides), so the sequences of a group have
+ * about the same length; each group is filled at once by BatchMatrix.
+ *
+ * @param batch
+ * @param minimal_loop_length
+ * @param structures whether to trace back the dot-bracket structures too
+ * @return std::vector<BatchFold> in the order of batch
+ */
+std::vector<BatchFold> fold_batch(const std::vector<Sequence>& batch,
+                                  const int& minimal_loop_length,
+                                  bool structures = false) {
+    std::vector<BatchFold> folds(batch.size());
+    size_t longest = 0;
+    for (const Sequence& rna_sequence : batch) {
+        longest = std::max(longest, rna_sequence.size());
+    }
+
+    std::vector<size_t> order(batch.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return batch[a].size() < batch[b].size();
+    });
+
+    with_cell_type(longest, [&](auto cell) {
+        using Cell = decltype(cell);
+        constexpr size_t Lanes = 32 / sizeof(Cell);
+        BatchMatrix<Cell, Lanes> matrix;
+        std::vector<const Sequence*> group;
+
+        for (size_t first = 0; first < order.size(); first += Lanes) {
+            const size_t last = std::min(first + Lanes, order.size());
+            group.clear();
+            for (size_t g = first; g < last; g++) {
+                group.push_back(&batch[order[g]]);
+            }
+            matrix.fill(group, minimal_loop_length);
+
+            for (size_t lane = 0; lane < group.size(); lane++) {
+                const Sequence& rna_sequence = *group[lane];
+                BatchFold& result = folds[order[first + lane]];
+                if (rna_sequence.empty()) {
+                    result = {0, ""};
+                    continue;
+                }
+                const size_t end = rna_sequence.size() - 1;
+                result.score = matrix.at(lane, 0, end);
+                if (structures) {
+                    std::vector<std::pair<int, int>> fold;
+                    traceback(typename BatchMatrix<Cell, Lanes>::Lane{matrix,
+                                                                      lane},
+                              rna_sequence, fold, 0, end);
+                    result.structure = dot_write(rna_sequence, fold);
+                }
+            }
+        }
+    });
+
+    return folds;
+}
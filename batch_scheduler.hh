@@ -0,0 +1,157 @@
+/**
+ * @file batch_scheduler.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Folding many sequences of mixed lengths across all cores
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "fold_result.hh"
+#include "sequence.hh"
+#include "thread_pool.hh"
+
+/**
+ * @brief How a call to fold_all spent its time
+ *
+ */
+struct BatchReport {
+    size_t jobs = 0;
+    size_t threads = 0;
+    size_t parallel_jobs = 0;   // jobs folded with create_matrix_parallel
+    double seconds = 0;         // wall time of the whole batch
+    double stealing_seconds = 0;  // wall time of the work stealing phase
+    double busy_seconds = 0;    // time threads spent folding in that phase
+
+    /**
+     * @brief Share of the threads kept busy during the work stealing phase
+     *
+     * @return double between 0 and 1
+     */
+    double utilization() const {
+        return stealing_seconds > 0 && threads > 0
+                   ? busy_seconds / (stealing_seconds * threads)
+                   : 0;
+    }
+};
+
+/**
+ * @brief Folds every sequence of batch and returns the results in the same
+ * order, with the structures already traced back.
+ *
+ * A fold costs about n^3, so the jobs are put in buckets by the power of two
+ * of their cost and the buckets are queued on a WorkStealingPool from the
+ * most expensive down; small jobs of a bucket are grouped into tasks of at
+ * least min_task_cost, so short sequences do not pay one task each. Every
+ * job runs the serial create_matrix. The long jobs that alone cost more than
+ * an even share of the whole batch would leave the other cores idle behind
+ * them; they are held back until the queue drains and then folded one after
+ * the other with create_matrix_parallel on all threads.
+ *
+ * @param batch
+ * @param minimal_loop_length
+ * @param thread_count number of threads, 0 means one per core
+ * @param report if not null, receives the timings and utilization
+ * @param min_task_cost smallest n^3 worth a task of its own
+ * @return std::vector<FoldResult> in the order of batch
+ */
+std::vector<FoldResult> fold_all(const std::vector<Sequence>& batch,
+                                 const int& minimal_loop_length,
+                                 size_t thread_count = 0,
+                                 BatchReport* report = nullptr,
+                                 double min_task_cost = 1e6) {
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    auto cost = [&](size_t job) {
+        return std::pow(double(batch[job].size()), 3);
+    };
+    double total_cost = 0;
+    for (size_t job = 0; job < batch.size(); job++) {
+        total_cost += cost(job);
+    }
+
+    // Buckets by the power of two of the cost, most expensive first
+    const double share = total_cost / thread_count;
+    std::map<int, std::vector<size_t>, std::greater<int>> buckets;
+    std::vector<size_t> long_jobs;
+    for (size_t job = 0; job < batch.size(); job++) {
+        if (thread_count > 1 && cost(job) > share &&
+            batch[job].size() >= 512) {
+            long_jobs.push_back(job);
+        } else {
+            buckets[std::ilogb(std::max(cost(job), 1.0))].push_back(job);
+        }
+    }
+
+    std::vector<std::optional<FoldResult>> results(batch.size());
+    std::atomic<int64_t> busy_nanoseconds{0};
+    auto fold_serial = [&](size_t job) {
+        results[job].emplace(fold(batch[job], minimal_loop_length,
+                                  FoldEngine::Serial, 1));
+        results[job]->dot_bracket();
+    };
+
+    std::vector<std::function<void()>> tasks;
+    for (const auto& [bucket, jobs] : buckets) {
+        for (size_t first = 0; first < jobs.size();) {
+            size_t last = first;
+            double task_cost = 0;
+            while (last < jobs.size() && task_cost < min_task_cost) {
+                task_cost += cost(jobs[last++]);
+            }
+            tasks.push_back([&, jobs = &jobs, first, last] {
+                const auto task_start = Clock::now();
+                for (size_t index = first; index < last; index++) {
+                    fold_serial((*jobs)[index]);
+                }
+                busy_nanoseconds +=
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        Clock::now() - task_start)
+                        .count();
+            });
+            first = last;
+        }
+    }
+
+    WorkStealingPool::shared(thread_count).run_all(std::move(tasks));
+    const auto drained = Clock::now();
+
+    for (size_t job : long_jobs) {
+        results[job].emplace(fold(batch[job], minimal_loop_length,
+                                  FoldEngine::Parallel, thread_count));
+        results[job]->dot_bracket();
+    }
+
+    if (report != nullptr) {
+        report->jobs = batch.size();
+        report->threads = thread_count;
+        report->parallel_jobs = long_jobs.size();
+        report->seconds =
+            std::chrono::duration<double>(Clock::now() - start).count();
+        report->stealing_seconds =
+            std::chrono::duration<double>(drained - start).count();
+        report->busy_seconds = busy_nanoseconds * 1e-9;
+    }
+
+    std::vector<FoldResult> folds;
+    folds.reserve(batch.size());
+    for (std::optional<FoldResult>& result : results) {
+        folds.push_back(std::move(*result));
+    }
+    return folds;
+}
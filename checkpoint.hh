@@ -0,0 +1,269 @@
+/**
+ * @file checkpoint.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Checkpoint and resume of long DP fills
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "herrlog.hh"
+#include "rna_folding.hh"
+#include "sequence.hh"
+#include "thread_pool.hh"
+
+/**
+ * @brief Binary file holding the finished diagonals of a DP matrix. A fixed
+ * header identifies the fold (length, loop length, cell size and a hash of
+ * the sequence) and counts the diagonals stored; the cells of diagonal 1, 2,
+ * ... follow, n - k cells for diagonal k. New diagonals are appended and
+ * synced before the header is updated, so a crash while saving leaves the
+ * previous checkpoint intact.
+ *
+ */
+class DiagonalCheckpoint {
+   private:
+    struct Header {
+        char magic[8];
+        uint64_t length;
+        int64_t minimal_loop_length;
+        uint64_t cell_size;
+        uint64_t sequence_hash;
+        uint64_t diagonals;
+    };
+
+    static constexpr char magic[8] = {'R', 'N', 'A', 'C', 'K', 'P', 'T', '1'};
+
+    std::string path;
+    int fd = -1;
+    Header header;
+
+    /**
+     * @brief FNV-1a hash of the nucleotides of the sequence
+     *
+     * @param rna_sequence
+     * @return uint64_t
+     */
+    static uint64_t hash(const Sequence& rna_sequence) {
+        uint64_t value = 14695981039346656037ull;
+        for (size_t i = 0; i < rna_sequence.size(); i++) {
+            value = (value ^ uint8_t(rna_sequence[i])) * 1099511628211ull;
+        }
+        return value;
+    }
+
+    /**
+     * @brief Position in the file of the first cell of diagonal k, k >= 1
+     *
+     * @param k
+     * @return off_t
+     */
+    off_t offset(size_t k) const {
+        const size_t before = (k - 1) * header.length - (k - 1) * k / 2;
+        return sizeof(Header) + before * header.cell_size;
+    }
+
+    void write_header() {
+        if (pwrite(fd, &header, sizeof(Header), 0) != sizeof(Header) ||
+            fsync(fd) != 0) {
+            Logger::error("Failed to write the checkpoint file {}", path);
+        }
+    }
+
+   public:
+    /**
+     * @brief Opens the checkpoint at path for a fold of rna_sequence. A file
+     * written for the same fold is resumed from; anything else is replaced by
+     * an empty checkpoint.
+     *
+     * @param path
+     * @param rna_sequence
+     * @param minimal_loop_length
+     * @param cell_size sizeof the cell type of the matrix
+     */
+    DiagonalCheckpoint(const std::string& path, const Sequence& rna_sequence,
+                       int minimal_loop_length, size_t cell_size)
+        : path(path) {
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.length = rna_sequence.size();
+        header.minimal_loop_length = minimal_loop_length;
+        header.cell_size = cell_size;
+        header.sequence_hash = hash(rna_sequence);
+        header.diagonals = 0;
+
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            Logger::error("Failed to open the checkpoint file {}", path);
+        }
+
+        Header stored;
+        if (pread(fd, &stored, sizeof(Header), 0) == sizeof(Header) &&
+            std::memcmp(stored.magic, magic, sizeof(magic)) == 0 &&
+            stored.length == header.length &&
+            stored.minimal_loop_length == header.minimal_loop_length &&
+            stored.cell_size == header.cell_size &&
+            stored.sequence_hash == header.sequence_hash &&
+            stored.diagonals < std::max<uint64_t>(header.length, 1)) {
+            header.diagonals = stored.diagonals;
+            return;
+        }
+
+        if (lseek(fd, 0, SEEK_END) > 0) {
+            Logger::warn("Checkpoint {} belongs to another fold, starting over",
+                         path);
+        }
+        if (ftruncate(fd, 0) != 0) {
+            Logger::error("Failed to reset the checkpoint file {}", path);
+        }
+        write_header();
+    }
+
+    DiagonalCheckpoint(const DiagonalCheckpoint&) = delete;
+    DiagonalCheckpoint& operator=(const DiagonalCheckpoint&) = delete;
+
+    ~DiagonalCheckpoint() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    /**
+     * @brief Number of finished diagonals stored, diagonal 0 not counted
+     *
+     * @return size_t
+     */
+    size_t diagonals() const { return header.diagonals; }
+
+    /**
+     * @brief Copies the stored diagonals into the matrix and its mirror
+     *
+     * @tparam Cell
+     * @param dp
+     * @param columns
+     */
+    template <typename Cell>
+    void load(TriangularMatrix<Cell>& dp,
+              ColumnTriangularMatrix<Cell>& columns) const {
+        std::vector<Cell> diagonal(header.length);
+        for (size_t k = 1; k <= header.diagonals; k++) {
+            const size_t bytes = (header.length - k) * sizeof(Cell);
+            if (pread(fd, diagonal.data(), bytes, offset(k)) != ssize_t(bytes)) {
+                Logger::error("Failed to read the checkpoint file {}", path);
+            }
+            for (size_t i = 0; i + k < header.length; i++) {
+                dp(i, i + k) = diagonal[i];
+                columns(i, i + k) = diagonal[i];
+            }
+        }
+    }
+
+    /**
+     * @brief Appends the diagonals after the stored ones up to diagonals,
+     * which must all be finished in dp
+     *
+     * @tparam Cell
+     * @param dp
+     * @param diagonals last finished diagonal
+     * @return size_t bytes written
+     */
+    template <typename Cell>
+    size_t save(const TriangularMatrix<Cell>& dp, size_t diagonals) {
+        if (diagonals <= header.diagonals) {
+            return 0;
+        }
+        std::vector<Cell> cells;
+        for (size_t k = header.diagonals + 1; k <= diagonals; k++) {
+            for (size_t i = 0; i + k < header.length; i++) {
+                cells.push_back(dp(i, i + k));
+            }
+        }
+        const size_t bytes = cells.size() * sizeof(Cell);
+        if (pwrite(fd, cells.data(), bytes, offset(header.diagonals + 1)) !=
+                ssize_t(bytes) ||
+            fsync(fd) != 0) {
+            Logger::error("Failed to write the checkpoint file {}", path);
+        }
+        header.diagonals = diagonals;
+        write_header();
+        return bytes + sizeof(Header);
+    }
+};
+
+/**
+ * @brief Version of create_matrix_parallel that can survive being killed.
+ * The finished diagonals are appended to a DiagonalCheckpoint at path every
+ * interval seconds, and a fold started again with the same checkpoint
+ * continues after the last saved diagonal. Every checkpoint only writes the
+ * diagonals finished since the previous one, so over the whole fill each
+ * cell is written once; the time spent saving is logged.
+ *
+ * @tparam Cell cell type, see with_cell_type for picking the narrowest one
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param path checkpoint file, created if missing
+ * @param interval seconds between two checkpoints
+ * @param thread_count number of threads, 0 means one per core
+ * @return TriangularMatrix<Cell>
+ */
+template <typename Cell = int>
+TriangularMatrix<Cell> create_matrix_checkpointed(
+    const Sequence& rna_sequence, const int& minimal_loop_length,
+    const std::string& path, double interval = 600, size_t thread_count = 0) {
+    using Clock = std::chrono::steady_clock;
+    const size_t n = rna_sequence.size();
+    check_cell_type<Cell>(n);
+    TriangularMatrix<Cell> dp(n);
+    ColumnTriangularMatrix<Cell> columns(n);
+
+    DiagonalCheckpoint checkpoint(path, rna_sequence, minimal_loop_length,
+                                  sizeof(Cell));
+    if (checkpoint.diagonals() > 0) {
+        checkpoint.load(dp, columns);
+        Logger::info("Resuming from diagonal {} of {}",
+                     checkpoint.diagonals(), n - 1);
+    }
+
+    ThreadPool& pool = ThreadPool::shared(thread_count);
+    const auto start = Clock::now();
+    auto last_save = start;
+    double saving = 0;
+
+    auto save = [&](size_t diagonals) {
+        const auto before = Clock::now();
+        const size_t bytes = checkpoint.save(dp, diagonals);
+        last_save = Clock::now();
+        const double seconds =
+            std::chrono::duration<double>(last_save - before).count();
+        saving += seconds;
+        Logger::info("Checkpointed diagonal {} ({} bytes) in {} s", diagonals,
+                     bytes, seconds);
+    };
+
+    for (size_t k = checkpoint.diagonals() + 1; k < n; k++) {
+        pool.parallel_for(0, n - k, [&](size_t i) {
+            fill_cell(dp, columns, rna_sequence, minimal_loop_length, i, i + k);
+        });
+        if (std::chrono::duration<double>(Clock::now() - last_save).count() >=
+                interval &&
+            k + 1 < n) {
+            save(k);
+        }
+    }
+    if (n > 1 && checkpoint.diagonals() < n - 1) {
+        save(n - 1);
+    }
+
+    Logger::info("Checkpoints took {} s of {} s", saving,
+                 std::chrono::duration<double>(Clock::now() - start).count());
+    return dp;
+}
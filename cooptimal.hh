@@ -0,0 +1,288 @@
+/**
+ * @file cooptimal.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Counting and uniformly sampling the structures of optimal score
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "scoring.hh"
+#include "sequence.hh"
+#include "simd_kernels.hh"
+#include "thread_pool.hh"
+#include "triangular_matrix.hh"
+
+//! Exact structure count, saturating at its largest value
+using StructureCount = unsigned __int128;
+
+/**
+ * @brief Number of optimal structures of every segment, taken from a filled
+ * create_matrix matrix. Every count is kept twice: exactly in 128 bits,
+ * which saturates for counts of 2^128 or more, and as a double, which is
+ * only approximate but goes up to 2^1024 and is what sampling uses.
+ *
+ */
+struct OptimalCounts {
+    TriangularMatrix<StructureCount> exact;
+    TriangularMatrix<double> approximate;
+
+    /**
+     * @brief Exact number of optimal structures of the whole sequence,
+     * meaningful when not saturated()
+     *
+     * @return StructureCount
+     */
+    StructureCount count() const {
+        return exact.size() == 0 ? 1 : exact(0, exact.size() - 1);
+    }
+
+    /**
+     * @brief Whether count() stopped at its largest value
+     *
+     * @return bool
+     */
+    bool saturated() const {
+        return count() == std::numeric_limits<StructureCount>::max();
+    }
+
+    /**
+     * @brief Base 2 logarithm of the number of optimal structures of the
+     * whole sequence, the degeneracy of its optimum
+     *
+     * @return double
+     */
+    double log2_count() const {
+        return approximate.size() == 0
+                   ? 0
+                   : std::log2(approximate(0, approximate.size() - 1));
+    }
+};
+
+/**
+ * @brief Decimal digits of a structure count
+ *
+ * @param count
+ * @return std::string
+ */
+inline std::string count_string(StructureCount count) {
+    std::string digits;
+    do {
+        digits += char('0' + int(count % 10));
+        count /= 10;
+    } while (count > 0);
+    return std::string(digits.rbegin(), digits.rend());
+}
+
+/**
+ * @brief Counts the optimal structures of every segment of a filled matrix,
+ * with the decomposition of suboptimal_structures: in an optimal structure
+ * of i..j, either j is unpaired and i..j - 1 is optimal, or j pairs with a k
+ * for which i..k - 1 and k + 1..j - 1 are optimal and the scores add up to
+ * dp(i, j). Each cell tries every k once, so the counts take the time of
+ * the fill. As in the fill, the scan over k reads a row of dp and a column
+ * of a transposed mirror, both contiguous, and only the few k that reach
+ * the optimum, found with the vectorized find_sum, touch the counts. The
+ * diagonals are split over the shared thread pool.
+ *
+ * @tparam Scoring scoring policy the matrix was filled with
+ * @tparam Matrix TriangularMatrix, or anything with the at() of traceback
+ * @param dp filled matrix of create_matrix
+ * @param rna_sequence
+ * @param minimal_loop_length the one the matrix was filled with
+ * @param thread_count number of threads, 0 means one per core
+ * @return OptimalCounts
+ */
+template <typename Scoring = NussinovScoring, typename Matrix>
+OptimalCounts count_optimal_structures(const Matrix& dp,
+                                       const Sequence& rna_sequence,
+                                       int minimal_loop_length,
+                                       size_t thread_count = 0) {
+    const size_t n = rna_sequence.size();
+    const size_t loop = minimal_loop_length;
+    constexpr StructureCount most = std::numeric_limits<StructureCount>::max();
+    OptimalCounts counts{TriangularMatrix<StructureCount>(n),
+                         TriangularMatrix<double>(n)};
+
+    auto value = [&](size_t i, size_t j) {
+        return i > j ? 0 : int(dp.at(i, j));
+    };
+    auto add = [&](StructureCount& total, StructureCount count) {
+        total = total > most - count ? most : total + count;
+    };
+
+    // The scores as ints in both orders, so that dp(i, k - 1) and
+    // dp(k + 1, j - 1) are contiguous in k
+    ThreadPool& pool = ThreadPool::shared(thread_count);
+    TriangularMatrix<int> rows(n);
+    ColumnTriangularMatrix<int> columns(n);
+    pool.parallel_for(0, n, [&](size_t i) {
+        for (size_t j = i; j < n; j++) {
+            rows(i, j) = columns(i, j) = value(i, j);
+        }
+    });
+    // pair_scores[c * n + k] is the score of k with a pairable position of
+    // code c, 0 where k cannot pair
+    std::vector<int> pair_scores(4 * n);
+    for (size_t k = 0; k < n; k++) {
+        for (size_t c = 0; c < 4 && rna_sequence.is_pairable(k); c++) {
+            pair_scores[c * n + k] =
+                Scoring::pair_scores[(rna_sequence.code(k) << 2) | c];
+        }
+    }
+
+    for (size_t d = 0; d < n; d++) {
+        pool.parallel_for(0, n - d, [&](size_t i) {
+            const size_t j = i + d;
+            const int best = rows(i, j);
+            StructureCount exact = 1;
+            double approximate = 1;
+            if (d > 0) {
+                exact = 0;
+                approximate = 0;
+                if (rows(i, j - 1) == best) {
+                    exact = counts.exact(i, j - 1);
+                    approximate = counts.approximate(i, j - 1);
+                }
+            }
+            if (d <= loop || !rna_sequence.is_pairable(j)) {
+                counts.exact(i, j) = exact;
+                counts.approximate(i, j) = approximate;
+                return;
+            }
+            const int* scores = pair_scores.data() + rna_sequence.code(j) * n;
+            auto take = [&](size_t k) {
+                const StructureCount left = k > i ? counts.exact(i, k - 1) : 1;
+                const StructureCount inside =
+                    k + 1 < j ? counts.exact(k + 1, j - 1) : 1;
+                StructureCount product;
+                add(exact, __builtin_mul_overflow(left, inside, &product)
+                               ? most
+                               : product);
+                approximate +=
+                    (k > i ? counts.approximate(i, k - 1) : 1.0) *
+                    (k + 1 < j ? counts.approximate(k + 1, j - 1) : 1.0);
+            };
+            auto optimal = [&](size_t k) {
+                return scores[k] > 0 && (k > i ? value(i, k - 1) : 0) +
+                                                value(k + 1, j - 1) +
+                                                scores[k] ==
+                                            best;
+            };
+
+            // k = i and k = j - 1 read empty segments, the others run over
+            // row i and column j - 1 of the copies with find_sum
+            const size_t last = j - loop - 1;
+            if (optimal(i)) {
+                take(i);
+            }
+            const int* left_scores = rows.row(i);
+            const int* inside_scores = columns.column(j - 1);
+            const size_t stop = std::min(last + 1, j - 1);
+            for (size_t k = i + 1; k < stop; k++) {
+                k += find_sum(left_scores + (k - 1 - i), inside_scores + k + 1,
+                              scores + k, best, stop - k);
+                if (k < stop) {
+                    take(k);
+                }
+            }
+            if (last == j - 1 && last > i && optimal(last)) {
+                take(last);
+            }
+            counts.exact(i, j) = exact;
+            counts.approximate(i, j) = approximate;
+        });
+    }
+
+    return counts;
+}
+
+/**
+ * @brief Draws one optimal structure, every optimal structure equally
+ * likely. Each segment picks its alternative with probability proportional
+ * to the number of optimal structures behind it, scanning its partners
+ * once, so a sample costs O(n^2) at worst.
+ *
+ * @tparam Scoring scoring policy the matrix was filled with
+ * @tparam Matrix TriangularMatrix, or anything with the at() of traceback
+ * @tparam Random uniform random bit generator, such as std::mt19937_64
+ * @param counts counts of the same matrix
+ * @param dp filled matrix of create_matrix
+ * @param rna_sequence
+ * @param minimal_loop_length the one the matrix was filled with
+ * @param random
+ * @return std::vector<std::pair<int, int>> base pairs
+ */
+template <typename Scoring = NussinovScoring, typename Matrix,
+          typename Random>
+std::vector<std::pair<int, int>> sample_optimal_structure(
+    const OptimalCounts& counts, const Matrix& dp,
+    const Sequence& rna_sequence, int minimal_loop_length, Random& random) {
+    const size_t loop = minimal_loop_length;
+    auto value = [&](size_t i, size_t j) {
+        return i > j ? 0 : int(dp.at(i, j));
+    };
+    auto count = [&](size_t i, size_t j) {
+        return i > j ? 1.0 : counts.approximate(i, j);
+    };
+
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<std::pair<int, int>> fold;
+    std::vector<std::pair<size_t, size_t>> pending;
+    if (!rna_sequence.empty()) {
+        pending.push_back({0, rna_sequence.size() - 1});
+    }
+
+    while (!pending.empty()) {
+        auto [i, j] = pending.back();
+        pending.pop_back();
+
+        while (j > i + loop) {
+            const int best = value(i, j);
+            double draw = uniform(random) * counts.approximate(i, j);
+            size_t partner = j;
+            if (value(i, j - 1) == best) {
+                draw -= count(i, j - 1);
+            }
+
+            // Rounding may leave the draw unspent, then the last optimal
+            // partner is taken
+            for (size_t k = i; draw >= 0 && k + loop < j; k++) {
+                const int score = pair_score<Scoring>(rna_sequence, k, j);
+                if (score > 0 &&
+                    (k > i ? value(i, k - 1) : 0) + value(k + 1, j - 1) +
+                            score ==
+                        best) {
+                    partner = k;
+                    draw -= (k > i ? count(i, k - 1) : 1.0) *
+                            count(k + 1, j - 1);
+                }
+            }
+            if (partner == j) {
+                j--;
+                continue;
+            }
+
+            fold.push_back({int(partner), int(j)});
+            if (partner + 1 < j - 1) {
+                pending.push_back({partner + 1, j - 1});
+            }
+            if (partner == i) {
+                break;
+            }
+            j = partner - 1;
+        }
+    }
+    return fold;
+}
@@ -0,0 +1,502 @@
+/**
+ * @file energy_engine.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Minimum free energy folding with a nearest-neighbour energy model
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "rna_folding.hh"
+#include "sequence.hh"
+#include "simd_kernels.hh"
+#include "thread_pool.hh"
+#include "triangular_matrix.hh"
+
+/**
+ * @brief Nearest-neighbour parameters at 37 degrees, in units of 10 cal/mol
+ * (so -240 is -2.4 kcal/mol), stored as flat constant arrays. Stacking,
+ * hairpin, bulge and interior loop values follow the Turner 2004 set and the
+ * multiloop is linear with the Turner 1999 coefficients. Dangles, terminal
+ * mismatches, special hairpins and the 1x1/1x2/2x2 interior loop tables are
+ * left out, the small interior loops using generic values instead.
+ *
+ */
+namespace energy_parameters {
+//! Energy of anything impossible; sums of a few of them still fit an int
+inline constexpr int infinity = 1 << 26;
+
+//! Largest number of unpaired nucleotides in a bulge or interior loop
+inline constexpr size_t max_interior_loop = 30;
+
+/**
+ * @brief Pair type of (code(i) << 2) | code(j): CG 1, GC 2, GU 3, UG 4,
+ * AU 5, UA 6 and 0 for nucleotides that cannot pair
+ *
+ */
+inline constexpr std::array<uint8_t, 16> pair_types = {
+    //       A  C  G  U
+    /* A */ 0, 0, 0, 5,
+    /* C */ 0, 0, 1, 0,
+    /* G */ 0, 2, 0, 3,
+    /* U */ 6, 0, 4, 0,
+};
+
+/**
+ * @brief Stacking energy of the pair (i, j) on (i + 1, j - 1), indexed by
+ * 7 * type(i, j) + type(j - 1, i + 1)
+ *
+ */
+inline constexpr std::array<int, 49> stack = {
+    //  -    CG    GC    GU    UG    AU    UA
+    0,     0,    0,    0,    0,    0,    0,     // -
+    0,  -240, -330, -210, -140, -210, -210,    // CG
+    0,  -330, -340, -250, -150, -220, -240,    // GC
+    0,  -210, -250,  130,  -50, -140, -130,    // GU
+    0,  -140, -150,  -50,   30,  -60, -100,    // UG
+    0,  -210, -220, -140,  -60, -110,  -90,    // AU
+    0,  -210, -240, -130, -100,  -90, -130,    // UA
+};
+
+//! Hairpin loop energy by number of unpaired nucleotides
+inline constexpr std::array<int, 31> hairpin = {
+    infinity, infinity, infinity, 540, 560, 570, 540, 600, 550, 640, 650,
+    660,      670,      678,      686, 694, 701, 707, 713, 719, 725, 730,
+    735,      740,      744,      749, 753, 757, 761, 765, 769,
+};
+
+//! Bulge loop energy by number of unpaired nucleotides
+inline constexpr std::array<int, 31> bulge = {
+    infinity, 380, 280, 320, 360, 400, 440, 459, 470, 480, 490,
+    500,      510, 519, 527, 534, 541, 548, 554, 560, 565, 571,
+    576,      580, 585, 589, 594, 598, 602, 605, 609,
+};
+
+//! Interior loop energy by number of unpaired nucleotides on both sides
+inline constexpr std::array<int, 31> interior = {
+    infinity, infinity, 50,  160, 110, 200, 200, 210, 230, 240, 250,
+    260,      270,      280, 290, 290, 300, 310, 310, 320, 330, 330,
+    340,      340,      350, 350, 350, 360, 360, 370, 370,
+};
+
+//! Extrapolation of loops longer than the tables, times ln(size / 30)
+inline constexpr double loop_extrapolation = 107.856;
+
+//! Penalty of a helix ending in an AU, UA, GU or UG pair
+inline constexpr int terminal_au = 50;
+
+//! Interior loop asymmetry penalty per nucleotide, and its maximum
+inline constexpr int ninio = 60;
+inline constexpr int ninio_max = 300;
+
+//! Linear multiloop: closing pair, each branch and each unpaired nucleotide
+inline constexpr int multiloop_closing = 340;
+inline constexpr int multiloop_branch = 40;
+inline constexpr int multiloop_unpaired = 0;
+
+/**
+ * @brief Interior loop energy with its asymmetry penalty, indexed by
+ * 31 * left + right unpaired nucleotides, so the fill reads one value per
+ * candidate loop
+ *
+ */
+inline constexpr std::array<int, 31 * 31> interior_loops = [] {
+    std::array<int, 31 * 31> loops{};
+    for (int left = 0; left <= 30; left++) {
+        for (int right = 0; right <= 30; right++) {
+            const int asymmetry = left > right ? left - right : right - left;
+            loops[31 * left + right] =
+                left == 0 || right == 0 || left + right > 30
+                    ? infinity
+                    : interior[left + right] +
+                          std::min(ninio_max, ninio * asymmetry);
+        }
+    }
+    return loops;
+}();
+
+//! Terminal penalty of a pair by (code(i) << 2) | code(j)
+inline constexpr std::array<int, 16> terminal_penalties = {
+    //       A   C   G   U
+    /* A */ 0,  0,  0,  terminal_au,
+    /* C */ 0,  0,  0,  0,
+    /* G */ 0,  0,  0,  terminal_au,
+    /* U */ terminal_au, 0, terminal_au, 0,
+};
+}  // namespace energy_parameters
+
+/**
+ * @brief Pair type of (i, j), see energy_parameters::pair_types
+ *
+ * @param rna_sequence
+ * @param i
+ * @param j
+ * @return int 0 if i and j cannot pair
+ */
+inline int pair_type(const Sequence& rna_sequence, size_t i, size_t j) {
+    return energy_parameters::pair_types[(rna_sequence.code(i) << 2) |
+                                         rna_sequence.code(j)] *
+           (rna_sequence.is_pairable(i) & rna_sequence.is_pairable(j));
+}
+
+/**
+ * @brief Penalty of a helix ending in a pair of the given type
+ *
+ * @param type
+ * @return int
+ */
+inline int terminal_penalty(int type) {
+    return type > 2 ? energy_parameters::terminal_au : 0;
+}
+
+/**
+ * @brief Energy of the hairpin loop closed by a pair of the given type
+ *
+ * @param type
+ * @param size number of unpaired nucleotides
+ * @return int
+ */
+inline int hairpin_energy(int type, size_t size) {
+    using namespace energy_parameters;
+    if (size < hairpin.size()) {
+        return hairpin[size] + (size == 3 ? terminal_penalty(type) : 0);
+    }
+    return hairpin.back() +
+           int(std::lround(loop_extrapolation * std::log(size / 30.0)));
+}
+
+/**
+ * @brief Energy of the stack, bulge or interior loop between the outer pair
+ * (i, j) and the inner pair (k, l)
+ *
+ * @param type pair type of (i, j)
+ * @param inner pair type of (l, k)
+ * @param left k - i - 1 unpaired nucleotides
+ * @param right j - l - 1 unpaired nucleotides
+ * @return int
+ */
+inline int interior_energy(int type, int inner, size_t left, size_t right) {
+    using namespace energy_parameters;
+    if (left == 0 && right == 0) {
+        return stack[7 * type + inner];
+    }
+    if (left == 0 || right == 0) {
+        const size_t size = left + right;
+        return bulge[size] + (size == 1 ? stack[7 * type + inner]
+                                        : terminal_penalty(type) +
+                                              terminal_penalty(inner));
+    }
+    return interior_loops[31 * left + right] + terminal_penalty(type) +
+           terminal_penalty(inner);
+}
+
+/**
+ * @brief Filled matrices of the energy model. They hold scores, that is
+ * minus the free energy, so that every rule is a maximum like in
+ * create_matrix and the bifurcations can use max_plus.
+ *
+ */
+struct EnergyMatrices {
+    //! Best score of i..j with i and j paired together
+    TriangularMatrix<int> closed;
+    //! Best score of i..j as part of a multiloop, at least one branch
+    TriangularMatrix<int> multi;
+    //! exterior[j] is the best score of the prefix 0..j - 1
+    std::vector<int> exterior;
+};
+
+/**
+ * @brief Computes cell (i, j) of both matrices, every cell on a shorter
+ * diagonal must already be filled
+ *
+ * @param matrices
+ * @param multi_columns transposed mirror of matrices.multi
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param i
+ * @param j
+ */
+inline void fill_energy_cell(EnergyMatrices& matrices,
+                             ColumnTriangularMatrix<int>& multi_columns,
+                             const Sequence& rna_sequence,
+                             const uint8_t* codes,
+                             const int& minimal_loop_length, size_t i,
+                             size_t j) {
+    using namespace energy_parameters;
+    const int type = pair_type(rna_sequence, i, j);
+
+    int closed = -infinity;
+    if (type != 0 && j - i > size_t(minimal_loop_length)) {
+        closed = -hairpin_energy(type, j - i - 1);
+
+        // Stack and bulges, no unpaired nucleotide on one side
+        for (size_t u = 0; u <= max_interior_loop &&
+                           i + 2 + u + minimal_loop_length < j;
+             u++) {
+            const int right = pair_type(rna_sequence, j - 1 - u, i + 1);
+            if (right != 0) {
+                closed = std::max(closed, matrices.closed(i + 1, j - 1 - u) -
+                                              interior_energy(type, right, 0, u));
+            }
+            const int left = pair_type(rna_sequence, j - 1, i + 1 + u);
+            if (u > 0 && left != 0) {
+                closed = std::max(closed, matrices.closed(i + 1 + u, j - 1) -
+                                              interior_energy(type, left, u, 0));
+            }
+        }
+
+        // Interior loops (k, l) with both sides unpaired. Cells that cannot
+        // pair hold -infinity, so the inner loop needs no test.
+        const int outer = terminal_penalty(type);
+        for (size_t left = 1; left < max_interior_loop &&
+                              i + 3 + left + minimal_loop_length < j;
+             left++) {
+            const size_t k = i + 1 + left;
+            const int* row = matrices.closed.row(k);
+            const int* loops = interior_loops.data() + 31 * left;
+            const int* penalties =
+                terminal_penalties.data() + (rna_sequence.code(k) << 2);
+            for (size_t right = 1; left + right <= max_interior_loop &&
+                                   k + right + minimal_loop_length + 1 < j;
+                 right++) {
+                const size_t l = j - 1 - right;
+                closed = std::max(closed, row[l - k] - loops[right] - outer -
+                                              penalties[codes[l]]);
+            }
+        }
+
+        // Multiloop: i + 1..u and u + 1..j - 1 both hold branches
+        if (j - i > 2) {
+            closed = std::max(
+                closed, max_plus(matrices.multi.row(i + 1),
+                                 multi_columns.column(j - 1) + i + 2,
+                                 j - i - 2) -
+                            multiloop_closing - multiloop_branch -
+                            terminal_penalty(type));
+        }
+        closed = std::max(closed, -infinity);
+    }
+    matrices.closed(i, j) = closed;
+
+    int multi = std::max(matrices.multi(i + 1, j), matrices.multi(i, j - 1)) -
+                multiloop_unpaired;
+    if (closed > -infinity) {
+        multi = std::max(
+            multi, closed - multiloop_branch - terminal_penalty(type));
+    }
+    multi = std::max(multi, max_plus(matrices.multi.row(i),
+                                     multi_columns.column(j) + i + 1, j - i));
+    multi = std::max(multi, -infinity);
+    matrices.multi(i, j) = multi;
+    multi_columns(i, j) = multi;
+}
+
+/**
+ * @brief Fills the matrices of the energy model, the thermodynamic
+ * counterpart of create_matrix: diagonal by diagonal on the shared thread
+ * pool, packed matrices, and max_plus over a transposed mirror for the
+ * multiloop bifurcations. Bulges and interior loops are limited to
+ * max_interior_loop unpaired nucleotides, which keeps the fill O(n^3).
+ *
+ * @param rna_sequence
+ * @param minimal_loop_length fewest unpaired nucleotides in a hairpin, the
+ * model itself forbids fewer than 3
+ * @param thread_count number of threads, 0 means one per core
+ * @return EnergyMatrices
+ */
+EnergyMatrices create_energy_matrices(const Sequence& rna_sequence,
+                                      const int& minimal_loop_length = 3,
+                                      size_t thread_count = 0) {
+    using energy_parameters::infinity;
+    const size_t n = rna_sequence.size();
+    EnergyMatrices matrices{TriangularMatrix<int>(n), TriangularMatrix<int>(n),
+                            std::vector<int>(n + 1, 0)};
+    ColumnTriangularMatrix<int> multi_columns(n);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i; j < n; j++) {
+            matrices.closed(i, j) = -infinity;
+            matrices.multi(i, j) = -infinity;
+            multi_columns(i, j) = -infinity;
+        }
+    }
+
+    std::vector<uint8_t> codes(n);
+    for (size_t i = 0; i < n; i++) {
+        codes[i] = rna_sequence.code(i);
+    }
+
+    ThreadPool& pool = ThreadPool::shared(thread_count);
+    for (size_t k = 1; k < n; k++) {
+        pool.parallel_for(0, n - k, [&](size_t i) {
+            fill_energy_cell(matrices, multi_columns, rna_sequence,
+                             codes.data(), minimal_loop_length, i, i + k);
+        });
+    }
+
+    // Exterior loop: j - 1 unpaired, or closing a helix started at i
+    for (size_t j = 1; j <= n; j++) {
+        int best = matrices.exterior[j - 1];
+        for (size_t i = 0; i + 1 < j; i++) {
+            const int closed = matrices.closed(i, j - 1);
+            if (closed > -infinity) {
+                best = std::max(
+                    best, matrices.exterior[i] + closed -
+                              terminal_penalty(pair_type(rna_sequence, i,
+                                                         j - 1)));
+            }
+        }
+        matrices.exterior[j] = best;
+    }
+
+    return matrices;
+}
+
+/**
+ * @brief Traces back a minimum free energy structure from the filled
+ * matrices, with an explicit stack like traceback
+ *
+ * @param matrices
+ * @param rna_sequence
+ * @param minimal_loop_length the one the matrices were filled with
+ * @param fold receives the base pairs
+ */
+void traceback_energy(const EnergyMatrices& matrices,
+                      const Sequence& rna_sequence,
+                      const int& minimal_loop_length,
+                      std::vector<std::pair<int, int>>& fold) {
+    using namespace energy_parameters;
+    enum Kind { Exterior, Closed, Multi };
+    std::vector<std::tuple<Kind, size_t, size_t>> pending = {
+        {Exterior, 0, rna_sequence.size()}};
+
+    while (!pending.empty()) {
+        auto [kind, i, j] = pending.back();
+        pending.pop_back();
+
+        if (kind == Exterior) {
+            // Prefix 0..j - 1
+            if (j == 0) {
+                continue;
+            }
+            if (matrices.exterior[j] == matrices.exterior[j - 1]) {
+                pending.push_back({Exterior, 0, j - 1});
+                continue;
+            }
+            for (size_t k = 0; k + 1 < j; k++) {
+                const int closed = matrices.closed(k, j - 1);
+                if (closed > -infinity &&
+                    matrices.exterior[k] + closed -
+                            terminal_penalty(pair_type(rna_sequence, k,
+                                                       j - 1)) ==
+                        matrices.exterior[j]) {
+                    pending.push_back({Closed, k, j - 1});
+                    pending.push_back({Exterior, 0, k});
+                    break;
+                }
+            }
+        } else if (kind == Closed) {
+            fold.push_back({int(i), int(j)});
+            const int value = matrices.closed(i, j);
+            const int type = pair_type(rna_sequence, i, j);
+            if (value == -hairpin_energy(type, j - i - 1)) {
+                continue;
+            }
+
+            bool found = false;
+            for (size_t k = i + 1;
+                 !found && k + 1 < j && k - i - 1 <= max_interior_loop; k++) {
+                for (size_t l = j - 1;
+                     l - k > size_t(minimal_loop_length) &&
+                     (k - i - 1) + (j - l - 1) <= max_interior_loop;
+                     l--) {
+                    const int inner = pair_type(rna_sequence, l, k);
+                    if (inner != 0 &&
+                        matrices.closed(k, l) -
+                                interior_energy(type, inner, k - i - 1,
+                                                j - l - 1) ==
+                            value) {
+                        pending.push_back({Closed, k, l});
+                        found = true;
+                        break;
+                    }
+                }
+            }
+
+            const int branches = value + multiloop_closing + multiloop_branch +
+                                 terminal_penalty(type);
+            for (size_t u = i + 1; !found && u + 1 < j; u++) {
+                if (matrices.multi(i + 1, u) + matrices.multi(u + 1, j - 1) ==
+                    branches) {
+                    pending.push_back({Multi, i + 1, u});
+                    pending.push_back({Multi, u + 1, j - 1});
+                    found = true;
+                }
+            }
+        } else {
+            const int value = matrices.multi(i, j);
+            if (i < j &&
+                matrices.multi(i + 1, j) - multiloop_unpaired == value) {
+                pending.push_back({Multi, i + 1, j});
+            } else if (i < j &&
+                       matrices.multi(i, j - 1) - multiloop_unpaired == value) {
+                pending.push_back({Multi, i, j - 1});
+            } else if (matrices.closed(i, j) > -infinity &&
+                       matrices.closed(i, j) - multiloop_branch -
+                               terminal_penalty(pair_type(rna_sequence, i, j)) ==
+                           value) {
+                pending.push_back({Closed, i, j});
+            } else {
+                for (size_t u = i; u < j; u++) {
+                    if (matrices.multi(i, u) + matrices.multi(u + 1, j) ==
+                        value) {
+                        pending.push_back({Multi, i, u});
+                        pending.push_back({Multi, u + 1, j});
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Minimum free energy structure of a sequence
+ *
+ */
+struct EnergyFold {
+    int energy;  // in units of 10 cal/mol
+    std::vector<std::pair<int, int>> pairs;
+    std::string structure;
+};
+
+/**
+ * @brief Folds a sequence to its minimum free energy structure with the
+ * nearest-neighbour model of energy_parameters
+ *
+ * @param rna_sequence
+ * @param minimal_loop_length fewest unpaired nucleotides in a hairpin
+ * @param thread_count number of threads, 0 means one per core
+ * @return EnergyFold
+ */
+EnergyFold fold_energy(const Sequence& rna_sequence,
+                       const int& minimal_loop_length = 3,
+                       size_t thread_count = 0) {
+    const EnergyMatrices matrices = create_energy_matrices(
+        rna_sequence, minimal_loop_length, thread_count);
+    EnergyFold result{-matrices.exterior.back(), {}, ""};
+    traceback_energy(matrices, rna_sequence, minimal_loop_length,
+                     result.pairs);
+    result.structure = dot_write(rna_sequence, result.pairs);
+    return result;
+}
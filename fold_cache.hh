@@ -0,0 +1,355 @@
+/**
+ * @file fold_cache.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Persistent cache of fold results shared between runs and processes
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "fold_result.hh"
+#include "herrlog.hh"
+#include "scoring.hh"
+#include "sequence.hh"
+
+//! Bumped whenever a change to the engines can change a cached result
+inline constexpr uint32_t fold_engine_version = 1;
+
+/**
+ * @brief Score and dot-bracket structure of a cached fold
+ *
+ */
+struct CachedFold {
+    int score;
+    std::string structure;
+};
+
+/**
+ * @brief Content-addressed cache of folds. The key is a 128-bit hash of the
+ * normalized sequence, the minimal loop length, the scoring model and
+ * fold_engine_version. Each result is one small binary file under the cache
+ * directory, holding a header and the structure at 2 bits per position;
+ * files are written under a temporary name and renamed into place, so
+ * processes sharing the directory never see a partial record and need no
+ * lock. The most recently used records are also kept in memory.
+ *
+ * Safe to use from several threads at once.
+ *
+ */
+class FoldCache {
+   public:
+    //! 128-bit key of a fold
+    using Key = std::pair<uint64_t, uint64_t>;
+
+   private:
+    struct Header {
+        char magic[8];
+        uint64_t key_low;
+        uint64_t key_high;
+        uint64_t length;
+        int64_t score;
+    };
+
+    static constexpr char magic[8] = {'R', 'N', 'A', 'F', 'O', 'L', 'D', '1'};
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const { return key.first; }
+    };
+
+    std::filesystem::path directory;
+    size_t capacity;
+    ScoringModel model;
+
+    std::mutex mutex;
+    std::list<std::pair<Key, CachedFold>> recent;  // most recent first
+    std::unordered_map<Key, decltype(recent)::iterator, KeyHash> entries;
+
+    std::atomic<size_t> memory_hits{0};
+    std::atomic<size_t> disk_hits{0};
+    std::atomic<size_t> misses{0};
+    std::atomic<size_t> written{0};
+
+    /**
+     * @brief File holding the record of key, in a subdirectory named after
+     * its first byte so that no directory grows too large
+     *
+     * @param key
+     * @return std::filesystem::path
+     */
+    std::filesystem::path path(const Key& key) const {
+        char name[40];
+        std::snprintf(name, sizeof(name), "%016llx%016llx",
+                      static_cast<unsigned long long>(key.second),
+                      static_cast<unsigned long long>(key.first));
+        return directory / std::string(name, 2) /
+               (std::string(name + 2) + ".fold");
+    }
+
+    /**
+     * @brief Moves key to the front of the LRU list, or inserts it there and
+     * drops the least recently used record when over capacity. Requires the
+     * mutex.
+     *
+     * @param key
+     * @param fold
+     */
+    void remember(const Key& key, const CachedFold& fold) {
+        auto entry = entries.find(key);
+        if (entry != entries.end()) {
+            recent.splice(recent.begin(), recent, entry->second);
+            return;
+        }
+        recent.emplace_front(key, fold);
+        entries[key] = recent.begin();
+        if (recent.size() > capacity) {
+            entries.erase(recent.back().first);
+            recent.pop_back();
+        }
+    }
+
+    /**
+     * @brief Reads the record of key from disk
+     *
+     * @param key
+     * @param length expected number of nucleotides
+     * @return std::optional<CachedFold> nothing if missing or damaged
+     */
+    std::optional<CachedFold> read(const Key& key, size_t length) const {
+        std::ifstream file(path(key), std::ios::binary);
+        Header header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(Header)) ||
+            std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+            header.key_low != key.first || header.key_high != key.second ||
+            header.length != length) {
+            return std::nullopt;
+        }
+
+        std::vector<uint8_t> packed((length + 3) / 4);
+        if (!file.read(reinterpret_cast<char*>(packed.data()), packed.size())) {
+            return std::nullopt;
+        }
+        static constexpr char symbols[4] = {'.', '(', ')', '.'};
+        CachedFold fold{static_cast<int>(header.score),
+                        std::string(length, '.')};
+        for (size_t i = 0; i < length; i++) {
+            fold.structure[i] = symbols[(packed[i / 4] >> (2 * (i % 4))) & 3];
+        }
+        return fold;
+    }
+
+    /**
+     * @brief Writes the record of key to a temporary file and renames it into
+     * place. Failing to write only costs a later recomputation, so errors are
+     * logged as warnings.
+     *
+     * @param key
+     * @param fold
+     */
+    void write(const Key& key, const CachedFold& fold) {
+        Header header;
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.key_low = key.first;
+        header.key_high = key.second;
+        header.length = fold.structure.size();
+        header.score = fold.score;
+
+        std::vector<uint8_t> packed((fold.structure.size() + 3) / 4, 0);
+        for (size_t i = 0; i < fold.structure.size(); i++) {
+            const uint8_t symbol = fold.structure[i] == '('   ? 1
+                                   : fold.structure[i] == ')' ? 2
+                                                              : 0;
+            packed[i / 4] |= symbol << (2 * (i % 4));
+        }
+
+        const std::filesystem::path target = path(key);
+        std::error_code error;
+        std::filesystem::create_directories(target.parent_path(), error);
+        const std::filesystem::path temporary =
+            target.parent_path() /
+            (".tmp." + std::to_string(getpid()) + "." +
+             std::to_string(written++) + "." + target.filename().string());
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+            file.write(reinterpret_cast<const char*>(packed.data()),
+                       packed.size());
+            if (!file) {
+                Logger::warn("Failed to write the cache record {}",
+                             temporary.string());
+                std::filesystem::remove(temporary, error);
+                return;
+            }
+        }
+        std::filesystem::rename(temporary, target, error);
+        if (error) {
+            Logger::warn("Failed to store the cache record {}",
+                         target.string());
+            std::filesystem::remove(temporary, error);
+        }
+    }
+
+   public:
+    /**
+     * @brief Opens the cache stored under directory, created if missing
+     *
+     * @param directory
+     * @param capacity records kept in memory
+     * @param model scoring policy of every fold, its name is part of the key
+     */
+    explicit FoldCache(const std::string& directory, size_t capacity = 4096,
+                       ScoringModel model = ScoringModel::Nussinov)
+        : directory(directory),
+          capacity(std::max<size_t>(capacity, 1)),
+          model(model) {
+        std::error_code error;
+        std::filesystem::create_directories(this->directory, error);
+        if (error) {
+            Logger::error("Failed to create the cache directory {}", directory);
+        }
+    }
+
+    FoldCache(const FoldCache&) = delete;
+    FoldCache& operator=(const FoldCache&) = delete;
+
+    /**
+     * @brief Key of the fold of rna_sequence: two FNV-1a hashes with
+     * different offsets over the nucleotides, the loop length, the model and
+     * the engine version
+     *
+     * @param rna_sequence
+     * @param minimal_loop_length
+     * @return Key
+     */
+    Key key(const Sequence& rna_sequence, int minimal_loop_length) const {
+        uint64_t low = 14695981039346656037ull;
+        uint64_t high = 0x6c62272e07bb0142ull;
+        auto add = [&](uint8_t byte) {
+            low = (low ^ byte) * 1099511628211ull;
+            high = (high ^ byte) * 1099511628211ull;
+            high ^= high >> 29;
+        };
+        for (size_t i = 0; i < rna_sequence.size(); i++) {
+            add(rna_sequence[i]);
+        }
+        add('\0');
+        for (size_t byte = 0; byte < sizeof(int); byte++) {
+            add(uint8_t(uint32_t(minimal_loop_length) >> (8 * byte)));
+        }
+        for (const char* c = scoring_name(model); *c != '\0'; c++) {
+            add(*c);
+        }
+        add('\0');
+        for (size_t byte = 0; byte < sizeof(uint32_t); byte++) {
+            add(uint8_t(fold_engine_version >> (8 * byte)));
+        }
+        return {low, high};
+    }
+
+    /**
+     * @brief Looks the fold up in memory, then on disk
+     *
+     * @param rna_sequence
+     * @param minimal_loop_length
+     * @return std::optional<CachedFold> nothing on a miss
+     */
+    std::optional<CachedFold> find(const Sequence& rna_sequence,
+                                   int minimal_loop_length) {
+        const Key fold_key = key(rna_sequence, minimal_loop_length);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto entry = entries.find(fold_key);
+            if (entry != entries.end()) {
+                recent.splice(recent.begin(), recent, entry->second);
+                memory_hits++;
+                return entry->second->second;
+            }
+        }
+
+        std::optional<CachedFold> fold = read(fold_key, rna_sequence.size());
+        if (!fold) {
+            misses++;
+            return std::nullopt;
+        }
+        disk_hits++;
+        std::lock_guard<std::mutex> lock(mutex);
+        remember(fold_key, *fold);
+        return fold;
+    }
+
+    /**
+     * @brief Stores a fold in memory and on disk
+     *
+     * @param rna_sequence
+     * @param minimal_loop_length
+     * @param fold
+     */
+    void store(const Sequence& rna_sequence, int minimal_loop_length,
+               const CachedFold& fold) {
+        const Key fold_key = key(rna_sequence, minimal_loop_length);
+        write(fold_key, fold);
+        std::lock_guard<std::mutex> lock(mutex);
+        remember(fold_key, fold);
+    }
+
+    /**
+     * @brief Cached version of fold: a hit skips the fill entirely, a miss
+     * folds with the given engine and stores the result
+     *
+     * @param rna_sequence
+     * @param minimal_loop_length
+     * @param engine
+     * @param thread_count
+     * @return CachedFold
+     */
+    CachedFold fold(const Sequence& rna_sequence, int minimal_loop_length,
+                    FoldEngine engine = FoldEngine::Parallel,
+                    size_t thread_count = 0) {
+        if (std::optional<CachedFold> cached =
+                find(rna_sequence, minimal_loop_length)) {
+            return *cached;
+        }
+        FoldResult result = ::fold(rna_sequence, minimal_loop_length, engine,
+                                   thread_count, true, model);
+        CachedFold computed{result.score(), result.dot_bracket()};
+        store(rna_sequence, minimal_loop_length, computed);
+        return computed;
+    }
+
+    /**
+     * @brief Lookups answered from memory
+     *
+     * @return size_t
+     */
+    size_t memory_hit_count() const { return memory_hits; }
+
+    /**
+     * @brief Lookups answered from disk
+     *
+     * @return size_t
+     */
+    size_t disk_hit_count() const { return disk_hits; }
+
+    /**
+     * @brief Lookups that found nothing
+     *
+     * @return size_t
+     */
+    size_t miss_count() const { return misses; }
+};
@@ -0,0 +1,254 @@
+/**
+ * @file fold_result.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Fold-once entry point sharing one DP matrix between all queries
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "four_russians.hh"
+#include "herrlog.hh"
+#include "rna_folding.hh"
+#include "scoring.hh"
+#include "sequence.hh"
+#include "sparse_engine.hh"
+#include "tiled_engine.hh"
+
+/**
+ * @brief Engines able to fill the DP matrix, all of them give the same matrix
+ *
+ */
+enum class FoldEngine {
+    Serial,        // create_matrix
+    Parallel,      // create_matrix_parallel
+    Tiled,         // create_matrix_tiled
+    FourRussians,  // create_matrix_four_russians
+    Sparse,        // create_matrix_sparse
+};
+
+/**
+ * @brief Owns the filled DP matrix of one sequence and answers every question
+ * about the fold from it: score, substring scores, base pairs and dot-bracket
+ * notation. Base pairs and dot-bracket are only traced back when first asked
+ * for. Move-only, so the matrix is never copied by accident.
+ *
+ */
+class FoldResult {
+   public:
+    //! DP matrix in any of the cell types chosen by with_cell_type
+    using Matrix = std::variant<TriangularMatrix<uint8_t>,
+                                TriangularMatrix<int16_t>,
+                                TriangularMatrix<int>>;
+
+   private:
+    Sequence rna_sequence;
+    int minimal_loop_length;
+    Matrix matrix;
+    std::optional<TracebackMatrix> steps;
+    ScoringModel model;
+    mutable std::optional<std::vector<std::pair<int, int>>> fold;
+    mutable std::optional<std::string> dot_notation;
+
+   public:
+    /**
+     * @brief Construct a new Fold Result object from an already filled matrix
+     *
+     * @param rna_sequence
+     * @param minimal_loop_length
+     * @param matrix
+     * @param steps winning rules recorded during the fill, if any
+     * @param model scoring policy the matrix was filled with
+     */
+    FoldResult(Sequence rna_sequence, int minimal_loop_length,
+               Matrix matrix,
+               std::optional<TracebackMatrix> steps = std::nullopt,
+               ScoringModel model = ScoringModel::Nussinov)
+        : rna_sequence(std::move(rna_sequence)),
+          minimal_loop_length(minimal_loop_length),
+          matrix(std::move(matrix)),
+          steps(std::move(steps)),
+          model(model) {}
+
+    FoldResult(const FoldResult&) = delete;
+    FoldResult& operator=(const FoldResult&) = delete;
+    FoldResult(FoldResult&&) = default;
+    FoldResult& operator=(FoldResult&&) = default;
+
+    /**
+     * @brief The folded sequence
+     *
+     * @return const Sequence&
+     */
+    const Sequence& sequence() const { return rna_sequence; }
+
+    /**
+     * @brief Number of nucleotides in the sequence
+     *
+     * @return size_t
+     */
+    size_t size() const { return rna_sequence.size(); }
+
+    /**
+     * @brief Minimal loop length the matrix was filled with
+     *
+     * @return int
+     */
+    int loop_length() const { return minimal_loop_length; }
+
+    /**
+     * @brief Scoring policy the matrix was filled with
+     *
+     * @return ScoringModel
+     */
+    ScoringModel scoring() const { return model; }
+
+    /**
+     * @brief Calls visitor with the DP matrix, whatever its cell type
+     *
+     * @tparam Visitor
+     * @param visitor
+     * @return auto whatever visitor returns
+     */
+    template <typename Visitor>
+    auto visit_matrix(Visitor visitor) const {
+        return std::visit(visitor, matrix);
+    }
+
+    /**
+     * @brief Number of bonds in the substring i..j, both ends included
+     *
+     * @param i
+     * @param j
+     * @return int
+     */
+    int score(size_t i, size_t j) const {
+        return visit_matrix(
+            [&](const auto& dp) { return static_cast<int>(dp.at(i, j)); });
+    }
+
+    /**
+     * @brief Number of bonds of the whole sequence
+     *
+     * @return int
+     */
+    int score() const { return size() == 0 ? 0 : score(0, size() - 1); }
+
+    /**
+     * @brief Base pairs of an optimal structure, traced back on first use,
+     * from the recorded rules when there are any. Not safe to call for the
+     * first time from several threads at once.
+     *
+     * @return const std::vector<std::pair<int, int>>&
+     */
+    const std::vector<std::pair<int, int>>& pairs() const {
+        if (!fold) {
+            fold.emplace();
+            if (size() > 0 && steps) {
+                traceback(*steps, *fold, 0, size() - 1);
+            } else if (size() > 0) {
+                with_scoring(model, [&](auto scoring) {
+                    visit_matrix([&](const auto& dp) {
+                        traceback<decltype(scoring)>(dp, rna_sequence, *fold,
+                                                     0, size() - 1);
+                    });
+                });
+            }
+        }
+        return *fold;
+    }
+
+    /**
+     * @brief Dot-bracket notation of the structure returned by pairs
+     *
+     * @return const std::string&
+     */
+    const std::string& dot_bracket() const {
+        if (!dot_notation) {
+            dot_notation = dot_write(rna_sequence, pairs());
+        }
+        return *dot_notation;
+    }
+};
+
+/**
+ * @brief Folds a sequence once with the chosen engine, using the narrowest
+ * cell type that fits. Unless disabled, the engines that can (all but
+ * FourRussians and Sparse) also record the winning rule of every cell, which costs two
+ * bytes per cell and makes the traceback a linear walk.
+ *
+ * The scoring model is turned into its policy type once here, so the fill
+ * itself is specialized for it. Only the Serial and Parallel engines take a
+ * policy; with any other model the other engines fall back to Parallel.
+ *
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param engine
+ * @param thread_count used by the parallel engines, 0 means one per core
+ * @param record_steps
+ * @param model scoring policy
+ * @return FoldResult
+ */
+FoldResult fold(const Sequence& rna_sequence,
+                const int& minimal_loop_length = 0,
+                FoldEngine engine = FoldEngine::Parallel,
+                size_t thread_count = 0, bool record_steps = true,
+                ScoringModel model = ScoringModel::Nussinov) {
+    if (model != ScoringModel::Nussinov && engine != FoldEngine::Serial &&
+        engine != FoldEngine::Parallel) {
+        Logger::warn("The {} scoring needs the serial or parallel engine, "
+                     "using the parallel one",
+                     scoring_name(model));
+        engine = FoldEngine::Parallel;
+    }
+
+    std::optional<TracebackMatrix> steps;
+    if (record_steps && engine != FoldEngine::FourRussians &&
+        engine != FoldEngine::Sparse &&
+        traceback_matrix_fits(rna_sequence.size())) {
+        steps.emplace();
+    }
+    TracebackMatrix* recorded = steps ? &*steps : nullptr;
+
+    FoldResult::Matrix matrix = with_scoring(model, [&](auto scoring) {
+        using Scoring = decltype(scoring);
+        return with_cell_type(
+            rna_sequence.size(),
+            [&](auto cell) {
+                using Cell = decltype(cell);
+                switch (engine) {
+                    case FoldEngine::Parallel:
+                        return FoldResult::Matrix(
+                            create_matrix_parallel<Cell, Scoring>(
+                                rna_sequence, minimal_loop_length,
+                                thread_count, 512, recorded));
+                    case FoldEngine::Tiled:
+                        return FoldResult::Matrix(create_matrix_tiled<Cell>(
+                            rna_sequence, minimal_loop_length, thread_count,
+                            64, recorded));
+                    case FoldEngine::FourRussians:
+                        return FoldResult::Matrix(
+                            create_matrix_four_russians<Cell>(
+                                rna_sequence, minimal_loop_length));
+                    case FoldEngine::Sparse:
+                        return FoldResult::Matrix(create_matrix_sparse<Cell>(
+                            rna_sequence, minimal_loop_length));
+                    case FoldEngine::Serial:
+                    default:
+                        return FoldResult::Matrix(create_matrix<Cell, Scoring>(
+                            rna_sequence, minimal_loop_length, recorded));
+                }
+            },
+            max_pair_score<Scoring>());
+    });
+    return FoldResult(rna_sequence, minimal_loop_length, std::move(matrix),
+                      std::move(steps), model);
+}
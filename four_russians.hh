@@ -0,0 +1,181 @@
+/**
+ * @file four_russians.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Four-Russians speedup of the DP fill, O(n^3 / log n)
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "rna_folding.hh"
+
+/**
+ * @brief Lookup table of the Four-Russians engine. Within a group of q
+ * consecutive split points, the row values dp(i, k - 1) grow by 0 or 1 per
+ * step and the column values dp(k, j) shrink by 0 or 1 per step, so each side
+ * is described by q - 1 bits. The table stores, for every pair of bit
+ * vectors, the best sum over the group relative to the two base values.
+ *
+ */
+class FourRussiansTable {
+   private:
+    size_t group_size;
+    std::vector<uint8_t> best;
+
+   public:
+    /**
+     * @brief Construct a new table for groups of group_size split points
+     *
+     * @param group_size
+     */
+    explicit FourRussiansTable(size_t group_size)
+        : group_size(group_size), best(size_t(1) << (2 * (group_size - 1))) {
+        const uint32_t vectors = uint32_t(1) << (group_size - 1);
+        for (uint32_t row = 0; row < vectors; row++) {
+            for (uint32_t column = 0; column < vectors; column++) {
+                int value = 0;
+                for (size_t m = 0; m < group_size; m++) {
+                    value = std::max(
+                        value, std::popcount(row & ((uint32_t(1) << m) - 1)) +
+                                   std::popcount(column >> m));
+                }
+                best[(row << (group_size - 1)) | column] = value;
+            }
+        }
+    }
+
+    /**
+     * @brief Best sum over the group for the given row and column bit vectors
+     *
+     * @param row
+     * @param column
+     * @return int
+     */
+    int operator()(uint32_t row, uint32_t column) const {
+        return best[(row << (group_size - 1)) | column];
+    }
+};
+
+/**
+ * @brief Four-Russians version of create_matrix. The matrix is filled column
+ * by column. The split points k of the bifurcation rule are cut into groups
+ * of group_size; every group lying completely inside (i, j] is resolved with
+ * one lookup in a FourRussiansTable, and only the split points at the two
+ * ends are scanned one by one. Produces the same matrix as create_matrix.
+ *
+ * @tparam Cell cell type, see with_cell_type for picking the narrowest one
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param group_size split points per lookup, 0 picks about log2(n) / 2
+ * @return TriangularMatrix<Cell>
+ */
+template <typename Cell = int>
+TriangularMatrix<Cell> create_matrix_four_russians(
+    const Sequence& rna_sequence, const int& minimal_loop_length = 0,
+    size_t group_size = 0) {
+    const size_t n = rna_sequence.size();
+    check_cell_type<Cell>(n);
+
+    if (group_size == 0) {
+        group_size = std::bit_width(n) / 2 + 1;
+    }
+    group_size = std::clamp<size_t>(group_size, 2, 9);
+
+    const size_t q = group_size;
+    const size_t groups = n / q;
+    const FourRussiansTable table(q);
+
+    // Columns are read far more often than rows, so fill the transposed
+    // layout and copy it into a TriangularMatrix at the end
+    ColumnTriangularMatrix<Cell> columns(n);
+    auto at = [&](size_t i, size_t j) -> Cell {
+        return i > j ? Cell(0) : columns(i, j);
+    };
+
+    // dp(i, a - 1) and the row bit vector of group g (starting at a = g * q)
+    // for row i, stored at i * groups + g
+    std::vector<Cell> row_base(n * groups);
+    std::vector<uint16_t> row_bits(n * groups);
+    // dp(a + q - 1, j) and the column bit vector of group g for the current
+    // column j
+    std::vector<Cell> column_base(groups);
+    std::vector<uint16_t> column_bits(groups);
+
+    for (size_t j = 0; j < n; j++) {
+        // The last column of group g is done, so its row vectors are known
+        if ((j + 1) % q == 0) {
+            const size_t g = (j + 1) / q - 1;
+            const size_t a = g * q;
+            for (size_t i = 0; i < a; i++) {
+                uint16_t bits = 0;
+                for (size_t m = 0; m + 1 < q; m++) {
+                    bits |= (columns(i, a + m) - columns(i, a + m - 1)) << m;
+                }
+                row_base[i * groups + g] = columns(i, a - 1);
+                row_bits[i * groups + g] = bits;
+            }
+        }
+
+        for (size_t i = j; i-- > 0;) {
+            // Rows a..a + q - 1 of this column are done
+            if ((i + 1) % q == 0 && i + q < j + 1) {
+                const size_t g = (i + 1) / q;
+                const size_t a = g * q;
+                uint16_t bits = 0;
+                for (size_t m = 0; m + 1 < q; m++) {
+                    bits |= (columns(a + m, j) - columns(a + m + 1, j)) << m;
+                }
+                column_base[g] = columns(a + q - 1, j);
+                column_bits[g] = bits;
+            }
+
+            if (j - i <= minimal_loop_length) {
+                columns(i, j) = 0;
+                continue;
+            }
+
+            // Split points k in (i, j], as dp(i, k - 1) + dp(k, j)
+            const size_t first_group = (i + q) / q;
+            const size_t last_group = (j + 1) / q;
+            int rc = std::numeric_limits<int>::min();
+            auto scan = [&](size_t begin, size_t end) {
+                for (size_t k = begin; k < end; k++) {
+                    rc = std::max(rc, columns(i, k - 1) + columns(k, j));
+                }
+            };
+
+            if (first_group < last_group) {
+                scan(i + 1, first_group * q);
+                const Cell* base = row_base.data() + i * groups;
+                const uint16_t* bits = row_bits.data() + i * groups;
+                for (size_t g = first_group; g < last_group; g++) {
+                    rc = std::max(rc, base[g] + column_base[g] +
+                                          table(bits[g], column_bits[g]));
+                }
+                scan(last_group * q, j + 1);
+            } else {
+                scan(i + 1, j + 1);
+            }
+
+            columns(i, j) = std::max(
+                {int(columns(i + 1, j)), int(columns(i, j - 1)),
+                 at(i + 1, j - 1) + rna_sequence.can_pair(i, j),
+                 rc});
+        }
+    }
+
+    TriangularMatrix<Cell> dp(n);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i; j < n; j++) {
+            dp(i, j) = columns(i, j);
+        }
+    }
+    return dp;
+}
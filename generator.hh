@@ -0,0 +1,122 @@
+/**
+ * @file generator.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Minimal coroutine generator, until std::generator of C++23
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <optional>
+#include <utility>
+
+/**
+ * @brief Lazy sequence of values produced by a coroutine with co_yield. The
+ * coroutine runs only as far as the values read, so a caller that stops
+ * early never pays for the rest. Move-only; iterate it once with a range
+ * for.
+ *
+ * @tparam T type of the values
+ */
+template <typename T>
+class Generator {
+   public:
+    struct promise_type {
+        std::optional<T> current;
+        std::exception_ptr exception;
+
+        Generator get_return_object() {
+            return Generator(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(T value) {
+            current = std::move(value);
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    /**
+     * @brief Input iterator over the values, resuming the coroutine on
+     * every increment
+     *
+     */
+    class iterator {
+       private:
+        std::coroutine_handle<promise_type> handle;
+
+       public:
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        explicit iterator(std::coroutine_handle<promise_type> handle)
+            : handle(handle) {}
+
+        T& operator*() const { return *handle.promise().current; }
+        T* operator->() const { return &*handle.promise().current; }
+
+        iterator& operator++() {
+            resume(handle);
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const {
+            return !handle || handle.done();
+        }
+    };
+
+    explicit Generator(std::coroutine_handle<promise_type> handle)
+        : handle(handle) {}
+    Generator(Generator&& other) noexcept
+        : handle(std::exchange(other.handle, nullptr)) {}
+    Generator& operator=(Generator&& other) noexcept {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+    Generator(const Generator&) = delete;
+    Generator& operator=(const Generator&) = delete;
+    ~Generator() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    /**
+     * @brief Runs the coroutine up to its first value
+     *
+     * @return iterator
+     */
+    iterator begin() {
+        resume(handle);
+        return iterator(handle);
+    }
+
+    std::default_sentinel_t end() const { return {}; }
+
+   private:
+    std::coroutine_handle<promise_type> handle;
+
+    /**
+     * @brief Resumes the coroutine and rethrows what escaped it
+     *
+     * @param handle
+     */
+    static void resume(std::coroutine_handle<promise_type> handle) {
+        handle.promise().current.reset();
+        handle.resume();
+        if (handle.promise().exception) {
+            std::rethrow_exception(
+                std::exchange(handle.promise().exception, nullptr));
+        }
+    }
+};
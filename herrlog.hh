@@ -33,6 +33,7 @@
 
 #include <chrono>
 #include <fstream>
+#include <iostream>
 #include <mutex>
 #include <ostream>
 #include <sstream>
@@ -0,0 +1,250 @@
+/**
+ * @file incremental.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Refolding after substitutions and single-point mutation scanning
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "fold_result.hh"
+#include "rna_folding.hh"
+#include "scoring.hh"
+#include "sequence.hh"
+#include "thread_pool.hh"
+
+/**
+ * @brief Nucleotide written at a position of a sequence
+ *
+ */
+struct Substitution {
+    size_t position;
+    char nucleotide;
+};
+
+/**
+ * @brief Score of the sequence with one substitution applied
+ *
+ */
+struct MutationScore {
+    size_t position;
+    char nucleotide;
+    int score;
+};
+
+/**
+ * @brief Brings a DP matrix up to date after the nucleotides at the given
+ * positions changed. Only cells (i, j) with i <= p <= j for a changed p can
+ * change, so only those are filled again, diagonal by diagonal as in
+ * create_matrix; all others keep their value.
+ *
+ * @tparam Scoring scoring policy the matrix was filled with
+ * @tparam Cell
+ * @param dp matrix of the sequence before the change, updated in place
+ * @param rna_sequence sequence after the change
+ * @param minimal_loop_length
+ * @param positions changed positions, in any order
+ */
+template <typename Scoring = NussinovScoring, typename Cell>
+void refill_matrix(TriangularMatrix<Cell>& dp, const Sequence& rna_sequence,
+                   const int& minimal_loop_length,
+                   const std::vector<size_t>& positions) {
+    const size_t n = rna_sequence.size();
+    if (positions.empty() || n == 0) {
+        return;
+    }
+
+    // next[i] is the first changed position at or after i, n if none
+    std::vector<size_t> next(n + 1, n);
+    for (size_t p : positions) {
+        next[p] = p;
+    }
+    for (size_t i = n; i-- > 0;) {
+        next[i] = std::min(next[i], next[i + 1]);
+    }
+    const size_t first = next[0];
+    const size_t last = *std::max_element(positions.begin(), positions.end());
+
+    ColumnTriangularMatrix<Cell> columns(n);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i; j < n; j++) {
+            columns(i, j) = dp(i, j);
+        }
+    }
+
+    for (size_t k = 1; k < n; k++) {
+        const size_t i_begin = first > k ? first - k : 0;
+        const size_t i_end = std::min(last + 1, n - k);
+        for (size_t i = i_begin; i < i_end; i++) {
+            if (next[i] <= i + k) {
+                fill_cell<Cell, Scoring>(dp, columns, rna_sequence,
+                                         minimal_loop_length, i, i + k);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Folds the sequence of result with the substitutions applied,
+ * starting from the matrix of result instead of from scratch. The traceback
+ * of the new result walks its matrix, as no steps are recorded.
+ *
+ * @param result
+ * @param substitutions
+ * @return FoldResult
+ */
+FoldResult refold(const FoldResult& result,
+                  const std::vector<Substitution>& substitutions) {
+    Sequence rna_sequence = result.sequence();
+    std::vector<size_t> positions;
+    for (const Substitution& substitution : substitutions) {
+        rna_sequence.set(substitution.position, substitution.nucleotide);
+        positions.push_back(substitution.position);
+    }
+
+    FoldResult::Matrix matrix =
+        with_scoring(result.scoring(), [&](auto scoring) {
+            return result.visit_matrix([&](const auto& dp) {
+                auto updated = dp;
+                refill_matrix<decltype(scoring)>(updated, rna_sequence,
+                                                 result.loop_length(),
+                                                 positions);
+                return FoldResult::Matrix(std::move(updated));
+            });
+        });
+    return FoldResult(std::move(rna_sequence), result.loop_length(),
+                      std::move(matrix), std::nullopt, result.scoring());
+}
+
+/**
+ * @brief Outside matrix of a filled DP matrix: cell (i, j) is the best
+ * number of bonds outside i..j over the structures in which no pair crosses
+ * the ends of i..j. The best structure holding the pair (i, j) then scores
+ * outside(i, j) + dp(i + 1, j - 1) plus the score of the pair, and the best
+ * one leaving p unpaired scores outside(p, p). A segment i..j either sits
+ * next to a finished segment k..i - 1 or j + 1..k of a longer segment, or is
+ * closed by the pair (i - 1, j + 1), so cells are filled from the longest
+ * segment down, each diagonal split across the threads of a pool.
+ *
+ * @tparam Scoring scoring policy the matrix was filled with
+ * @tparam Cell
+ * @param dp
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param thread_count number of threads, 0 means one per core
+ * @return TriangularMatrix<Cell>
+ */
+template <typename Scoring = NussinovScoring, typename Cell>
+TriangularMatrix<Cell> outside_matrix(const TriangularMatrix<Cell>& dp,
+                                      const Sequence& rna_sequence,
+                                      const int& minimal_loop_length,
+                                      size_t thread_count = 0) {
+    const size_t n = dp.size();
+    TriangularMatrix<Cell> outside(n);
+    if (n == 0) {
+        return outside;
+    }
+
+    // Transposed mirrors, so both operands of every max_plus are contiguous
+    ColumnTriangularMatrix<Cell> inside_columns(n);
+    ColumnTriangularMatrix<Cell> outside_columns(n);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i; j < n; j++) {
+            inside_columns(i, j) = dp(i, j);
+        }
+    }
+
+    ThreadPool& pool = ThreadPool::shared(thread_count);
+    for (size_t k = n - 1; k-- > 0;) {
+        pool.parallel_for(0, n - k, [&](size_t i) {
+            const size_t j = i + k;
+            Cell value = 0;
+            if (i > 0) {
+                value = std::max(value,
+                                 max_plus(outside_columns.column(j),
+                                          inside_columns.column(i - 1), i));
+            }
+            if (j + 1 < n) {
+                value = std::max(value, max_plus(outside.row(i) + (j + 1 - i),
+                                                 dp.row(j + 1), n - 1 - j));
+            }
+            if (i > 0 && j + 1 < n && k + 2 > minimal_loop_length) {
+                const uint8_t score =
+                    pair_score<Scoring>(rna_sequence, i - 1, j + 1);
+                if (score > 0) {
+                    value = std::max(value,
+                                     Cell(outside(i - 1, j + 1) + score));
+                }
+            }
+            outside(i, j) = value;
+            outside_columns(i, j) = value;
+        });
+    }
+
+    return outside;
+}
+
+/**
+ * @brief Scores every single-nucleotide variant of the sequence of result.
+ * Nothing outside a pair (p, q) depends on the nucleotide at p, so with the
+ * outside matrix of the original sequence a variant at p scores the best of
+ * outside(p, p), p left unpaired, and outside + pair + inside over the q that
+ * can pair with the new nucleotide. That is O(n) per variant after a single
+ * O(n^3) outside pass, instead of a refold per variant. Use refold for
+ * several substitutions at once.
+ *
+ * @param result
+ * @param thread_count number of threads, 0 means one per core
+ * @return std::vector<MutationScore> ordered by position, then by nucleotide
+ */
+std::vector<MutationScore> mutation_scan(const FoldResult& result,
+                                         size_t thread_count = 0) {
+    const Sequence& rna_sequence = result.sequence();
+    const int minimal_loop_length = result.loop_length();
+    const size_t n = result.size();
+    std::vector<MutationScore> scores(n * nucleotides.size());
+
+    with_scoring(result.scoring(), [&](auto scoring) {
+        using Scoring = decltype(scoring);
+        result.visit_matrix([&](const auto& dp) {
+            const auto outside = outside_matrix<Scoring>(
+                dp, rna_sequence, minimal_loop_length, thread_count);
+            ThreadPool::shared(thread_count).parallel_for(0, n, [&](size_t p) {
+                for (uint8_t code = 0; code < nucleotides.size(); code++) {
+                    if (rna_sequence.is_pairable(p) &&
+                        rna_sequence.code(p) == code) {
+                        continue;
+                    }
+                    int best = outside(p, p);
+                    for (size_t q = 0; q < n; q++) {
+                        const size_t i = std::min(p, q);
+                        const size_t j = std::max(p, q);
+                        const int score =
+                            Scoring::pair_scores[(code << 2) |
+                                                 rna_sequence.code(q)] *
+                            rna_sequence.is_pairable(q);
+                        if (j - i > minimal_loop_length && score > 0) {
+                            best = std::max(best, outside(i, j) + score +
+                                                      int(dp.at(i + 1, j - 1)));
+                        }
+                    }
+                    scores[p * nucleotides.size() + code] = {
+                        p, nucleotides[code], best};
+                }
+            });
+        });
+    });
+
+    // Slots of the original nucleotides were never written
+    std::vector<MutationScore> variants;
+    for (const MutationScore& score : scores) {
+        if (score.nucleotide != '\0') {
+            variants.push_back(score);
+        }
+    }
+    return variants;
+}
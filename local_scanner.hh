@@ -0,0 +1,242 @@
+/**
+ * @file local_scanner.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Streaming scanner reporting local structures of arbitrarily long
+ * sequences
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "rna_folding.hh"
+#include "sequence.hh"
+#include "simd_kernels.hh"
+
+/**
+ * @brief Local structure reported by LocalFoldScanner
+ *
+ */
+struct LocalStructure {
+    size_t begin;            // position of the first nucleotide, from 0
+    size_t end;              // position of the last nucleotide, included
+    int score;               // number of bonds
+    std::string structure;   // dot-bracket notation of begin..end
+};
+
+/**
+ * @brief Folds a sequence fed in chunks of any size with pairs limited to
+ * span, like create_matrix_banded, but only keeps the last span + 1 rows of
+ * the band. Memory is O(span^2) whatever the length of the input.
+ *
+ * Row i of the band is complete once nucleotide i + span has been read. The
+ * scanner then reports the best structure starting at i: the shortest
+ * substring i..e reaching the best score of the row, as long as i is paired
+ * in it and it does not lie inside the previously reported substring, which
+ * is at least as good.
+ *
+ * @tparam Cell cell type, see with_cell_type for picking the narrowest one
+ */
+template <typename Cell = int>
+class LocalFoldScanner {
+   public:
+    //! Called with every reported structure, in increasing order of begin
+    using Callback = std::function<void(const LocalStructure&)>;
+
+   private:
+    int minimal_loop_length;
+    size_t span;
+    size_t width;
+    int min_score;
+    Callback report;
+
+    std::vector<Cell> rows;
+    std::vector<Cell> column;
+    std::vector<uint8_t> codes;
+    std::vector<uint8_t> pairable;
+    size_t length = 0;
+    size_t next_row = 0;
+    size_t reported_end = 0;
+    bool reported_any = false;
+
+    /**
+     * @brief Cells of the band seen from position offset, so that traceback
+     * can walk a substring with coordinates starting at 0
+     *
+     */
+    struct Window {
+        const LocalFoldScanner& scanner;
+        size_t offset;
+
+        Cell at(size_t i, size_t j) const {
+            return i > j ? Cell(0) : scanner.cell(offset + i, offset + j);
+        }
+    };
+
+    /**
+     * @brief Row i of the band, holding dp(i, i..i + span)
+     *
+     * @param i
+     * @return const Cell*
+     */
+    const Cell* row(size_t i) const {
+        return rows.data() + (i % width) * width;
+    }
+
+    /**
+     * @brief Cell (i, j) of the band, requires i <= j <= i + span and row i
+     * still being kept
+     *
+     * @param i
+     * @param j
+     * @return Cell
+     */
+    Cell cell(size_t i, size_t j) const {
+        return rows[(i % width) * width + (j - i)];
+    }
+
+    /**
+     * @brief Fills column j of the band with the normalized nucleotide c
+     *
+     * @param c
+     */
+    void add(char c) {
+        const size_t j = length;
+        size_t slot = j % width;
+        const uint8_t code = nucleotide_code(c) & 3;
+        const uint8_t code_pairable = nucleotide_code(c) < 4;
+        codes[slot] = code;
+        pairable[slot] = code_pairable;
+        rows[slot * width] = 0;
+        column[span] = 0;
+
+        // Walk up the rows, stepping the ring slot instead of taking i % width
+        const size_t i_begin = j - std::min(j, span);
+        for (size_t i = j; i-- > i_begin;) {
+            Cell* below = rows.data() + slot * width;
+            slot = slot == 0 ? span : slot - 1;
+            Cell* current = rows.data() + slot * width;
+            const uint8_t can_pair = pair_table[(codes[slot] << 2) | code] &
+                                     pairable[slot] & code_pairable;
+
+            Cell value = 0;
+            if (j - i > minimal_loop_length) {
+                value = std::max(
+                    {column[span - (j - i - 1)], current[j - 1 - i],
+                     Cell((i + 1 <= j - 1 ? below[j - 2 - i] : Cell(0)) +
+                          can_pair),
+                     max_plus(static_cast<const Cell*>(current),
+                              column.data() + span - (j - i) + 1, j - i)});
+            }
+            current[j - i] = value;
+            column[span - (j - i)] = value;
+        }
+
+        length++;
+        if (j >= span) {
+            complete_row(j - span);
+        }
+    }
+
+    /**
+     * @brief Reports the best structure starting at i, if any. Every cell of
+     * row i must be filled and rows i..length - 1 still kept.
+     *
+     * @param i
+     */
+    void complete_row(size_t i) {
+        next_row = i + 1;
+        const size_t last = std::min(i + span, length - 1);
+        const Cell* values = row(i);
+        const int best = values[last - i];
+        if (best < min_score) {
+            return;
+        }
+
+        size_t end = i;
+        while (values[end - i] != best) {
+            end++;
+        }
+        if (cell(i + 1, end) == best ||
+            (reported_any && end <= reported_end)) {
+            return;
+        }
+
+        Sequence local;
+        for (size_t k = i; k <= end; k++) {
+            local.push_back(pairable[k % width]
+                                ? nucleotides[codes[k % width]]
+                                : 'N');
+        }
+        std::vector<std::pair<int, int>> fold;
+        traceback(Window{*this, i}, local, fold, 0, end - i);
+
+        reported_any = true;
+        reported_end = end;
+        report(LocalStructure{i, end, best, dot_write(local, fold)});
+    }
+
+   public:
+    /**
+     * @brief Construct a new scanner
+     *
+     * @param minimal_loop_length
+     * @param span largest allowed j - i of a pair
+     * @param report called with every reported structure
+     * @param min_score structures with fewer bonds are not reported
+     */
+    LocalFoldScanner(int minimal_loop_length, size_t span, Callback report,
+                     int min_score = 1)
+        : minimal_loop_length(minimal_loop_length),
+          span(span),
+          width(span + 1),
+          min_score(std::max(min_score, 1)),
+          report(std::move(report)),
+          rows(width * width, 0),
+          column(width, 0),
+          codes(width, 0),
+          pairable(width, 0) {
+        check_cell_type<Cell>(width);
+    }
+
+    /**
+     * @brief Reads the next chunk of the sequence, normalized like a Sequence.
+     * Whitespace is skipped, so a file can be fed in blocks without caring
+     * about line breaks.
+     *
+     * @param chunk
+     */
+    void push(const std::string& chunk) {
+        for (char c : chunk) {
+            c = normalize_nucleotide(c);
+            if (c != '\0') {
+                add(c);
+            }
+        }
+    }
+
+    /**
+     * @brief Ends the sequence and reports the structures starting in its
+     * last span nucleotides. The scanner must not be pushed to afterwards.
+     *
+     */
+    void finish() {
+        while (next_row < length) {
+            complete_row(next_row);
+        }
+    }
+
+    /**
+     * @brief Number of nucleotides read so far
+     *
+     * @return size_t
+     */
+    size_t size() const { return length; }
+};
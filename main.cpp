@@ -9,7 +9,21 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 
+#include <chrono>
+
+#include "batch_scheduler.hh"
+#include "checkpoint.hh"
+#include "cooptimal.hh"
+#include "energy_engine.hh"
+#include "fold_cache.hh"
+#include "fold_result.hh"
+#include "local_scanner.hh"
+#include "online_folder.hh"
+#include "partition_function.hh"
 #include "rna_folding.hh"
+#include "sequence.hh"
+#include "structure_sampler.hh"
+#include "suboptimal.hh"
 #include "herrlog.hh"
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -197,6 +211,253 @@ void display() {
     glutSwapBuffers();
 }
 
+/**
+ * @brief Streams the file through a LocalFoldScanner in fixed size blocks and
+ * prints every local structure as it is found, so memory does not grow with
+ * the length of the input
+ *
+ * @param file
+ * @param minimal_loop_length
+ * @param span largest allowed distance between paired nucleotides
+ * @return int exit code
+ */
+int scan(std::ifstream& file, int minimal_loop_length, size_t span) {
+    auto start = std::chrono::steady_clock::now();
+    size_t scanned = with_cell_type(span + 1, [&](auto cell) {
+        LocalFoldScanner<decltype(cell)> scanner(
+            minimal_loop_length, span, [](const LocalStructure& local) {
+                std::cout << local.structure << " (" << local.score << ") "
+                          << local.begin + 1 << "\n";
+            });
+        std::string block(1 << 16, '\0');
+        while (file.read(block.data(), block.size()) || file.gcount() > 0) {
+            scanner.push(block.substr(0, file.gcount()));
+        }
+        scanner.finish();
+        return scanner.size();
+    });
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+    Logger::info("Scanned {} nucleotides in {} s ({} nt/s)", scanned, seconds,
+                 seconds > 0 ? static_cast<size_t>(scanned / seconds) : 0);
+    return 0;
+}
+
+/**
+ * @brief Streams the file through an OnlineFolder and prints the score of
+ * the sequence read so far after every block, so partial results are out
+ * while a long transcript is still being read
+ *
+ * @param file
+ * @param minimal_loop_length
+ * @return int exit code
+ */
+int stream(std::ifstream& file, int minimal_loop_length) {
+    OnlineFolder<int> folder(minimal_loop_length);
+    std::string block(1 << 12, '\0');
+    while (file.read(block.data(), block.size()) || file.gcount() > 0) {
+        const int score = folder.append(
+            std::span<const char>(block.data(), file.gcount()));
+        std::cout << folder.size() << " " << score << "\n" << std::flush;
+    }
+
+    std::vector<std::pair<int, int>> fold;
+    if (folder.size() > 0) {
+        traceback(folder, folder.sequence(), fold, 0, folder.size() - 1);
+    }
+    Logger::info("Dot-bracket notation: {}",
+                 dot_write(folder.sequence(), fold));
+    Logger::info("Total number of bonds: {}", folder.score());
+    return 0;
+}
+
+/**
+ * @brief Folds every line of the file as a sequence of its own on all cores
+ * and prints the structures in the order of the lines
+ *
+ * @param file
+ * @param minimal_loop_length
+ * @return int exit code
+ */
+int batch(std::ifstream& file, int minimal_loop_length) {
+    std::vector<Sequence> sequences;
+    std::string line;
+    while (std::getline(file, line)) {
+        sequences.emplace_back(line);
+    }
+
+    BatchReport report;
+    const std::vector<FoldResult> results =
+        fold_all(sequences, minimal_loop_length, 0, &report);
+    for (const FoldResult& result : results) {
+        std::cout << result.dot_bracket() << " (" << result.score() << ")\n";
+    }
+
+    Logger::info("Folded {} sequences in {} s on {} threads", report.jobs,
+                 report.seconds, report.threads);
+    Logger::info("Utilization {} over {} s, then {} long sequences in {} s",
+                 report.utilization(), report.stealing_seconds,
+                 report.parallel_jobs,
+                 report.seconds - report.stealing_seconds);
+    return 0;
+}
+
+/**
+ * @brief Folds the first line of the file to its minimum free energy
+ * structure and prints it with the energy in kcal/mol
+ *
+ * @param file
+ * @param minimal_loop_length
+ * @return int exit code
+ */
+int energy(std::ifstream& file, int minimal_loop_length) {
+    std::string line;
+    std::getline(file, line);
+    const Sequence sequence(line);
+
+    auto start = std::chrono::steady_clock::now();
+    const EnergyFold result = fold_energy(sequence, minimal_loop_length);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+    Logger::info("Dot-bracket notation: {}", result.structure);
+    Logger::info("Minimum free energy: {} kcal/mol", result.energy / 100.0);
+    Logger::info("Total number of bonds: {}", result.pairs.size());
+    Logger::info("Folded {} nucleotides in {} s", sequence.size(), seconds);
+    return 0;
+}
+
+/**
+ * @brief Prints the base pairs of the first line of the file whose
+ * probability in the ensemble is at least cutoff, one "i j probability" per
+ * line with positions counted from 1
+ *
+ * @param file
+ * @param minimal_loop_length
+ * @param cutoff
+ * @return int exit code
+ */
+int probabilities(std::ifstream& file, int minimal_loop_length,
+                  double cutoff) {
+    std::string line;
+    std::getline(file, line);
+    const Sequence sequence(line);
+
+    auto start = std::chrono::steady_clock::now();
+    const PartitionMatrices matrices =
+        create_partition_matrices(sequence, minimal_loop_length);
+    const std::vector<PairProbability> pairs =
+        pair_probabilities(matrices, sequence, cutoff);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+    for (const PairProbability& pair : pairs) {
+        std::cout << pair.i + 1 << " " << pair.j + 1 << " "
+                  << pair.probability << "\n";
+    }
+    Logger::info("Log partition function: {}", matrices.log_partition());
+    Logger::info("{} pairs above {} in {} s", pairs.size(), cutoff, seconds);
+    return 0;
+}
+
+/**
+ * @brief Prints count structures of the first line of the file drawn from
+ * its ensemble, one dot-bracket per line
+ *
+ * @param file
+ * @param minimal_loop_length
+ * @param count
+ * @return int exit code
+ */
+int sample(std::ifstream& file, int minimal_loop_length, size_t count) {
+    std::string line;
+    std::getline(file, line);
+    const Sequence sequence(line);
+
+    auto start = std::chrono::steady_clock::now();
+    const PartitionMatrices matrices =
+        create_partition_matrices(sequence, minimal_loop_length);
+    auto filled = std::chrono::steady_clock::now();
+    const std::vector<std::string> structures =
+        StructureSampler(matrices, sequence).sample_many(count);
+    auto end = std::chrono::steady_clock::now();
+
+    for (const std::string& structure : structures) {
+        std::cout << structure << "\n";
+    }
+    Logger::info("Partition function in {} s, {} samples in {} s",
+                 std::chrono::duration<double>(filled - start).count(), count,
+                 std::chrono::duration<double>(end - filled).count());
+    return 0;
+}
+
+/**
+ * @brief Prints the count best structures of the first line of the file,
+ * best first, with their scores
+ *
+ * @param file
+ * @param minimal_loop_length
+ * @param count
+ * @return int exit code
+ */
+int suboptimal(std::ifstream& file, int minimal_loop_length, size_t count) {
+    std::string line;
+    std::getline(file, line);
+    const Sequence sequence(line);
+
+    const TriangularMatrix<int> dp =
+        create_matrix_parallel<int>(sequence, minimal_loop_length);
+    size_t printed = 0;
+    for (const SuboptimalStructure& structure :
+         suboptimal_structures(dp, sequence, minimal_loop_length)) {
+        if (printed++ == count) {
+            break;
+        }
+        std::cout << dot_write(sequence, structure.pairs) << " ("
+                  << structure.score << ")\n";
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints the number of optimal structures of the first line of the
+ * file and count of them drawn uniformly, one dot-bracket per line
+ *
+ * @param file
+ * @param minimal_loop_length
+ * @param count
+ * @return int exit code
+ */
+int cooptimal(std::ifstream& file, int minimal_loop_length, size_t count) {
+    std::string line;
+    std::getline(file, line);
+    const Sequence sequence(line);
+
+    const TriangularMatrix<int> dp =
+        create_matrix_parallel<int>(sequence, minimal_loop_length);
+    const OptimalCounts counts =
+        count_optimal_structures(dp, sequence, minimal_loop_length);
+    std::mt19937_64 random(0);
+    for (size_t s = 0; s < count; s++) {
+        std::cout << dot_write(sequence,
+                               sample_optimal_structure(
+                                   counts, dp, sequence, minimal_loop_length,
+                                   random))
+                  << "\n";
+    }
+
+    if (counts.saturated()) {
+        Logger::info("About 2^{} optimal structures", counts.log2_count());
+    } else {
+        Logger::info("{} optimal structures", count_string(counts.count()));
+    }
+    return 0;
+}
+
 int main(int argc, char** argv) {
     std::ifstream file;
     if (argc >= 1) {
@@ -210,18 +471,74 @@ int main(int argc, char** argv) {
         Logger::error("Failed to open the file.");
     }
 
-    std::string rna_sequence;
-    std::getline(file, rna_sequence);
-    number_of_nucleotides = rna_sequence.size();
     const int minimal_loop_length = 4;
+    if (argc >= 4 && std::string(argv[2]) == "--scan") {
+        return scan(file, minimal_loop_length, std::stoul(argv[3]));
+    }
+    if (argc >= 3 && std::string(argv[2]) == "--batch") {
+        return batch(file, minimal_loop_length);
+    }
+    if (argc >= 3 && std::string(argv[2]) == "--stream") {
+        return stream(file, minimal_loop_length);
+    }
+    if (argc >= 3 && std::string(argv[2]) == "--energy") {
+        return energy(file, minimal_loop_length);
+    }
+    if (argc >= 3 && std::string(argv[2]) == "--suboptimal") {
+        return suboptimal(file, minimal_loop_length,
+                          argc >= 4 ? std::stoul(argv[3]) : 10);
+    }
+    if (argc >= 3 && std::string(argv[2]) == "--cooptimal") {
+        return cooptimal(file, minimal_loop_length,
+                         argc >= 4 ? std::stoul(argv[3]) : 10);
+    }
+    if (argc >= 3 && std::string(argv[2]) == "--sample") {
+        return sample(file, minimal_loop_length,
+                      argc >= 4 ? std::stoul(argv[3]) : 1000);
+    }
+    if (argc >= 3 && std::string(argv[2]) == "--probabilities") {
+        return probabilities(file, minimal_loop_length,
+                             argc >= 4 ? std::stod(argv[3]) : 0.01);
+    }
+    std::string checkpoint_path;
+    if (argc >= 4 && std::string(argv[2]) == "--checkpoint") {
+        checkpoint_path = argv[3];
+    }
+    std::string cache_directory;
+    if (argc >= 4 && std::string(argv[2]) == "--cache") {
+        cache_directory = argv[3];
+    }
 
-    std::vector<std::pair<int, int>> fold;
-    traceback(create_matrix(rna_sequence, minimal_loop_length), rna_sequence,
-              fold, 0, rna_sequence.size() - 1);
+    std::string line;
+    std::getline(file, line);
+    const Sequence sequence(line);
+    const std::string rna_sequence = sequence.to_string();
+    number_of_nucleotides = rna_sequence.size();
 
-    std::string dot_notation = dot_write(rna_sequence, fold);
+    std::string dot_notation;
+    if (!cache_directory.empty()) {
+        FoldCache cache(cache_directory);
+        const CachedFold cached = cache.fold(sequence, minimal_loop_length);
+        dot_notation = cached.structure;
+        number_of_bonds = cached.score;
+        Logger::info("Fold cache {}: {} hits, {} misses", cache_directory,
+                     cache.memory_hit_count() + cache.disk_hit_count(),
+                     cache.miss_count());
+    } else {
+        FoldResult result =
+            checkpoint_path.empty()
+                ? fold(sequence, minimal_loop_length)
+                : FoldResult(sequence, minimal_loop_length,
+                             with_cell_type(sequence.size(), [&](auto cell) {
+                                 return FoldResult::Matrix(
+                                     create_matrix_checkpointed<decltype(cell)>(
+                                         sequence, minimal_loop_length,
+                                         checkpoint_path));
+                             }));
+        dot_notation = result.dot_bracket();
+        number_of_bonds = result.score();
+    }
 
-    number_of_bonds = rna_score(rna_sequence, minimal_loop_length);
     Logger::info("Input RNA sequence: {}", rna_sequence);
     Logger::info("Dot-bracket notation: {}", dot_notation);
     Logger::info("Total number of nucleotides: {}", rna_sequence.size());
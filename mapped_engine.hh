@@ -0,0 +1,304 @@
+/**
+ * @file mapped_engine.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Out-of-core DP fill into a memory-mapped file
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include "herrlog.hh"
+#include "rna_folding.hh"
+#include "sequence.hh"
+#include "simd_kernels.hh"
+
+/**
+ * @brief Upper-triangular matrix stored in a memory-mapped file, so that it
+ * can be far larger than RAM. Rows are grouped in stripes of stripe_height
+ * rows; stripe s stores its rows one after the other, each holding the
+ * columns s * stripe_height..n-1. Row i is thus contiguous from column i on,
+ * like in TriangularMatrix, and a tile of the matrix is a few contiguous
+ * runs inside one stripe.
+ *
+ * The mapping is shared with the file, so releasing a stripe only drops it
+ * from the process; the kernel writes it back and reads it again on demand.
+ *
+ * @tparam Cell type of a single cell
+ */
+template <typename Cell = int>
+class MappedTriangularMatrix {
+   private:
+    size_t n = 0;
+    size_t stripe_height = 1;
+    int fd = -1;
+    Cell* cells = nullptr;
+    size_t bytes = 0;
+    std::vector<size_t> stripe_offsets;
+
+    /**
+     * @brief Number of columns stored per row of stripe s
+     *
+     * @param s
+     * @return size_t
+     */
+    size_t stripe_width(size_t s) const { return n - s * stripe_height; }
+
+    void unmap() {
+        if (cells != nullptr) {
+            munmap(cells, bytes);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        cells = nullptr;
+        fd = -1;
+    }
+
+   public:
+    /**
+     * @brief Construct an empty matrix
+     *
+     */
+    MappedTriangularMatrix() = default;
+
+    /**
+     * @brief Maps an n x n matrix onto the file at path. With create, the
+     * file is created or truncated and every cell reads as zero; otherwise
+     * an existing file of the right size is mapped as is.
+     *
+     * @param path
+     * @param n
+     * @param stripe_height rows per stripe
+     * @param create
+     */
+    MappedTriangularMatrix(const std::string& path, size_t n,
+                           size_t stripe_height, bool create = true)
+        : n(n), stripe_height(std::max<size_t>(stripe_height, 1)) {
+        size_t offset = 0;
+        for (size_t s = 0; s * this->stripe_height < n; s++) {
+            stripe_offsets.push_back(offset);
+            offset += std::min(this->stripe_height, n - s * this->stripe_height) *
+                      stripe_width(s);
+        }
+        stripe_offsets.push_back(offset);
+        bytes = offset * sizeof(Cell);
+
+        fd = open(path.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR,
+                  0644);
+        if (fd < 0) {
+            Logger::error("Failed to open the matrix file {}", path);
+        }
+        if (create && ftruncate(fd, bytes) != 0) {
+            Logger::error("Failed to grow the matrix file {} to {} bytes", path,
+                          bytes);
+        }
+        struct stat status;
+        if (fstat(fd, &status) != 0 || size_t(status.st_size) != bytes) {
+            Logger::error("The matrix file {} does not hold a {} x {} matrix",
+                          path, n, n);
+        }
+        if (bytes > 0) {
+            void* mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED) {
+                Logger::error("Failed to map the matrix file {}", path);
+            }
+            cells = static_cast<Cell*>(mapping);
+        }
+    }
+
+    MappedTriangularMatrix(const MappedTriangularMatrix&) = delete;
+    MappedTriangularMatrix& operator=(const MappedTriangularMatrix&) = delete;
+
+    MappedTriangularMatrix(MappedTriangularMatrix&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    MappedTriangularMatrix& operator=(MappedTriangularMatrix&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            n = std::exchange(other.n, 0);
+            stripe_height = other.stripe_height;
+            fd = std::exchange(other.fd, -1);
+            cells = std::exchange(other.cells, nullptr);
+            bytes = std::exchange(other.bytes, 0);
+            stripe_offsets = std::move(other.stripe_offsets);
+        }
+        return *this;
+    }
+
+    ~MappedTriangularMatrix() { unmap(); }
+
+    /**
+     * @brief Position of cell (i, j) inside the file, requires i <= j
+     *
+     * @param i
+     * @param j
+     * @return size_t
+     */
+    size_t index(size_t i, size_t j) const {
+        const size_t s = i / stripe_height;
+        const size_t first = s * stripe_height;
+        return stripe_offsets[s] + (i - first) * stripe_width(s) + (j - first);
+    }
+
+    /**
+     * @brief Access cell (i, j), requires i <= j
+     *
+     * @param i
+     * @param j
+     * @return Cell&
+     */
+    Cell& operator()(size_t i, size_t j) { return cells[index(i, j)]; }
+
+    /**
+     * @brief Access cell (i, j), requires i <= j
+     *
+     * @param i
+     * @param j
+     * @return const Cell&
+     */
+    const Cell& operator()(size_t i, size_t j) const {
+        return cells[index(i, j)];
+    }
+
+    /**
+     * @brief Read cell (i, j). Cells below the diagonal read as zero, like in
+     * TriangularMatrix.
+     *
+     * @param i
+     * @param j
+     * @return Cell
+     */
+    Cell at(size_t i, size_t j) const {
+        return i > j ? Cell(0) : cells[index(i, j)];
+    }
+
+    /**
+     * @brief Pointer to cell (i, i), the columns i..n-1 of row i follow it
+     *
+     * @param i
+     * @return const Cell*
+     */
+    const Cell* row(size_t i) const { return cells + index(i, i); }
+
+    /**
+     * @brief Number of rows (and columns) of the matrix
+     *
+     * @return size_t
+     */
+    size_t size() const { return n; }
+
+    /**
+     * @brief Rows per stripe
+     *
+     * @return size_t
+     */
+    size_t stripe_size() const { return stripe_height; }
+
+    /**
+     * @brief Drops the pages of stripe s from the memory of the process. The
+     * cells stay in the file and are read back when next accessed.
+     *
+     * @param s
+     */
+    void release(size_t s) {
+        const size_t page = sysconf(_SC_PAGESIZE);
+        const size_t begin = stripe_offsets[s] * sizeof(Cell) / page * page;
+        const size_t end = stripe_offsets[s + 1] * sizeof(Cell);
+        if (end > begin) {
+            madvise(reinterpret_cast<char*>(cells) + begin, end - begin,
+                    MADV_DONTNEED);
+        }
+    }
+
+    /**
+     * @brief Writes every modified cell back to the file
+     *
+     */
+    void flush() {
+        if (cells != nullptr) {
+            msync(cells, bytes, MS_SYNC);
+        }
+    }
+};
+
+/**
+ * @brief Out-of-core version of create_matrix, for sequences whose matrix
+ * does not fit in RAM. The matrix is filled into a MappedTriangularMatrix at
+ * path, one column of tiles at a time from the bottom tile up:
+ *
+ * - row i of a tile is read straight from the file, where it is contiguous,
+ *   and the rows of a tile row are one stripe, so reads stream through it;
+ * - the columns of the current tile column are kept in RAM as they are
+ *   finished, which makes the second operand of max_plus contiguous too;
+ * - every stripe is released once its tile is done.
+ *
+ * The tile size is picked so that the column buffer plus one stripe fit in
+ * working_set bytes. The returned matrix can be traced back directly.
+ *
+ * @tparam Cell cell type, see with_cell_type for picking the narrowest one
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param path file backing the matrix, created or truncated
+ * @param working_set bytes of RAM the fill may keep resident
+ * @return MappedTriangularMatrix<Cell>
+ */
+template <typename Cell = int>
+MappedTriangularMatrix<Cell> create_matrix_mapped(
+    const Sequence& rna_sequence, const int& minimal_loop_length,
+    const std::string& path, size_t working_set = size_t(1) << 30) {
+    const size_t n = rna_sequence.size();
+    check_cell_type<Cell>(n);
+
+    const size_t tile_size = std::clamp<size_t>(
+        working_set / (2 * std::max<size_t>(n, 1) * sizeof(Cell)), 16,
+        std::max<size_t>(n, 16));
+    MappedTriangularMatrix<Cell> dp(path, n, tile_size);
+    const size_t tiles = (n + tile_size - 1) / tile_size;
+
+    // Column j of the current tile column, rows 0..j, at (j - first) * n
+    std::vector<Cell> columns(tile_size * n);
+
+    for (size_t tile_j = 0; tile_j < tiles; tile_j++) {
+        const size_t j_begin = tile_j * tile_size;
+        const size_t j_end = std::min(j_begin + tile_size, n);
+        std::fill(columns.begin(), columns.end(), Cell(0));
+
+        for (size_t tile_i = tile_j + 1; tile_i-- > 0;) {
+            const size_t i_begin = tile_i * tile_size;
+            const size_t i_end = std::min(i_begin + tile_size, n);
+
+            for (size_t i = i_end; i-- > i_begin;) {
+                const Cell* row = dp.row(i);
+                for (size_t j = std::max(j_begin, i + 1); j < j_end; j++) {
+                    Cell* column = columns.data() + (j - j_begin) * n;
+                    Cell value = 0;
+                    if (j - i > minimal_loop_length) {
+                        value = std::max(
+                            {column[i + 1], dp(i, j - 1),
+                             Cell(dp.at(i + 1, j - 1) +
+                                  rna_sequence.can_pair(i, j)),
+                             max_plus(row, column + i + 1, j - i)});
+                    }
+                    dp(i, j) = value;
+                    column[i] = value;
+                }
+            }
+            dp.release(tile_i);
+        }
+    }
+
+    return dp;
+}
@@ -0,0 +1,174 @@
+/**
+ * @file online_folder.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Fold extended one nucleotide at a time as the input streams in
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <span>
+#include <vector>
+#include "rna_folding.hh"
+#include "sequence.hh"
+#include "simd_kernels.hh"
+
+/**
+ * @brief Keeps the DP matrix of a growing sequence. Appending nucleotide j
+ * only adds column j, which depends on earlier columns alone: as in
+ * create_matrix_sparse, column j starts as a copy of column j - 1 (j
+ * unpaired) and every k that can pair with j folds dp(k + 1, j - 1) + 1 plus
+ * column k - 1 into it with max_plus_accumulate. An append is therefore
+ * O(n^2) at worst, and the score of the whole prefix is known right after it.
+ *
+ * Columns are stored one after the other in blocks, a new block being at
+ * least as large as all previous ones together. A column never straddles two
+ * blocks and blocks are never moved, so the matrix grows without copying a
+ * single finished cell.
+ *
+ * @tparam Cell cell type, must hold the scores of the longest prefix folded
+ */
+template <typename Cell = int>
+class OnlineFolder {
+   private:
+    int minimal_loop_length;
+    Sequence rna_sequence;
+    std::vector<std::unique_ptr<Cell[]>> blocks;
+    std::vector<Cell*> columns;  // column j holds the rows 0..j
+    size_t capacity = 0;         // cells allocated over all blocks
+    Cell* next = nullptr;        // first free cell of the last block
+    Cell* end = nullptr;         // end of the last block
+
+    /**
+     * @brief Storage for the j + 1 cells of column j
+     *
+     * @param j
+     * @return Cell*
+     */
+    Cell* allocate_column(size_t j) {
+        if (size_t(end - next) < j + 1) {
+            const size_t size = std::max(j + 1, capacity);
+            blocks.push_back(std::make_unique<Cell[]>(size));
+            capacity += size;
+            next = blocks.back().get();
+            end = next + size;
+        }
+        Cell* column = next;
+        next += j + 1;
+        return column;
+    }
+
+   public:
+    /**
+     * @brief Construct a folder for an empty sequence
+     *
+     * @param minimal_loop_length
+     * @param expected_length nucleotides to allocate room for up front
+     */
+    explicit OnlineFolder(int minimal_loop_length, size_t expected_length = 0)
+        : minimal_loop_length(minimal_loop_length) {
+        if (expected_length > 0) {
+            capacity = expected_length * (expected_length + 1) / 2;
+            blocks.push_back(std::make_unique<Cell[]>(capacity));
+            next = blocks.back().get();
+            end = next + capacity;
+            columns.reserve(expected_length);
+        }
+    }
+
+    /**
+     * @brief Appends a nucleotide, normalized first; whitespace is skipped
+     *
+     * @param c
+     * @return int score of the whole sequence read so far
+     */
+    int append(char c) {
+        c = normalize_nucleotide(c);
+        if (c == '\0') {
+            return score();
+        }
+        const size_t j = rna_sequence.size();
+        check_cell_type<Cell>(j + 1);
+        rna_sequence.push_back(c);
+
+        Cell* column = allocate_column(j);
+        column[j] = 0;
+        if (j > 0) {
+            // j unpaired
+            const Cell* previous = columns[j - 1];
+            std::copy(previous, previous + j, column);
+
+            // j paired with a candidate k
+            for (size_t k = 0; k + minimal_loop_length < j; k++) {
+                if (!rna_sequence.can_pair(k, j)) {
+                    continue;
+                }
+                const Cell closed = (k + 1 < j ? previous[k + 1] : Cell(0)) + 1;
+                if (k > 0) {
+                    max_plus_accumulate(column, closed, columns[k - 1], k);
+                }
+                column[k] = std::max(column[k], closed);
+            }
+        }
+        columns.push_back(column);
+        return score();
+    }
+
+    /**
+     * @brief Appends every nucleotide of chunk, see append(char)
+     *
+     * @param chunk
+     * @return int score of the whole sequence read so far
+     */
+    int append(std::span<const char> chunk) {
+        for (char c : chunk) {
+            append(c);
+        }
+        return score();
+    }
+
+    /**
+     * @brief Best number of bonds of the whole sequence read so far
+     *
+     * @return int
+     */
+    int score() const { return columns.empty() ? 0 : columns.back()[0]; }
+
+    /**
+     * @brief Read cell (i, j), cells below the diagonal read as zero. Lets
+     * traceback walk the matrix of the current sequence.
+     *
+     * @param i
+     * @param j
+     * @return Cell
+     */
+    Cell at(size_t i, size_t j) const {
+        return i > j ? Cell(0) : columns[j][i];
+    }
+
+    /**
+     * @brief Pointer to cell (0, j), the rows 0..j of column j follow it
+     *
+     * @param j
+     * @return const Cell*
+     */
+    const Cell* column(size_t j) const { return columns[j]; }
+
+    /**
+     * @brief Sequence read so far
+     *
+     * @return const Sequence&
+     */
+    const Sequence& sequence() const { return rna_sequence; }
+
+    /**
+     * @brief Number of nucleotides read so far
+     *
+     * @return size_t
+     */
+    size_t size() const { return rna_sequence.size(); }
+};
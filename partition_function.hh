@@ -0,0 +1,300 @@
+/**
+ * @file partition_function.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Partition function and base pair probabilities over the structures
+ * create_matrix scores
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+#include "scoring.hh"
+#include "sequence.hh"
+#include "simd_kernels.hh"
+#include "thread_pool.hh"
+#include "triangular_matrix.hh"
+
+/**
+ * @brief Probability of one base pair in the ensemble
+ *
+ */
+struct PairProbability {
+    int i;
+    int j;
+    double probability;
+};
+
+/**
+ * @brief Inside matrices of the partition function. Every structure
+ * create_matrix can pair is counted once, weighted by
+ * exp(score / temperature), with the unambiguous decomposition
+ *
+ *     Q(i, j) = Q(i, j - 1) + sum over k of Q(i, k - 1) * Qb(k, j)
+ *     Qb(k, j) = exp(pair_score(k, j) / temperature) * Q(k + 1, j - 1)
+ *
+ * where j is either unpaired or paired with k, and Q of an empty segment is 1.
+ *
+ * A partition function grows exponentially with the length, so a segment of
+ * length m is stored divided by scale^m; the scale is adjusted while filling
+ * so the stored values stay near 1 and sequences of any length neither
+ * overflow nor underflow.
+ *
+ */
+struct PartitionMatrices {
+    //! Q of each segment, row-major so row i is contiguous
+    TriangularMatrix<double> segment;
+    //! Qb of each segment, column-major so column j is contiguous
+    ColumnTriangularMatrix<double> closed;
+    //! Natural logarithm of the scale per nucleotide
+    double log_scale = 0;
+    //! exp(score / temperature) / scale^2 by (code(i) << 2) | code(j)
+    std::array<double, 16> pair_weights{};
+    int minimal_loop_length = 0;
+
+    /**
+     * @brief Scaled weight of the pair (i, j), 0 if they cannot pair
+     *
+     * @param rna_sequence
+     * @param i
+     * @param j
+     * @return double
+     */
+    double pair_weight(const Sequence& rna_sequence, size_t i,
+                       size_t j) const {
+        return pair_weights[(rna_sequence.code(i) << 2) |
+                            rna_sequence.code(j)] *
+               (rna_sequence.is_pairable(i) & rna_sequence.is_pairable(j));
+    }
+
+    /**
+     * @brief Scaled Q of the segment i..j, 1 if it is empty
+     *
+     * @param i
+     * @param j
+     * @return double
+     */
+    double inside(size_t i, size_t j) const {
+        return i > j ? 1.0 : segment(i, j);
+    }
+
+    /**
+     * @brief Natural logarithm of the partition function of the whole
+     * sequence
+     *
+     * @return double
+     */
+    double log_partition() const {
+        if (segment.size() == 0) {
+            return 0;
+        }
+        return std::log(segment(0, segment.size() - 1)) +
+               segment.size() * log_scale;
+    }
+};
+
+/**
+ * @brief Divides every filled cell of length m by factor^m after the scale
+ * was raised by log(factor), so the matrices stay consistent with it
+ *
+ * @param matrices
+ * @param filled longest filled segment
+ * @param log_factor
+ * @param pool
+ */
+inline void rescale_partition(PartitionMatrices& matrices, size_t filled,
+                              double log_factor, ThreadPool& pool) {
+    const size_t n = matrices.segment.size();
+    std::vector<double> factors(filled + 1);
+    for (size_t m = 0; m <= filled; m++) {
+        factors[m] = std::exp(-log_factor * double(m));
+    }
+    pool.parallel_for(0, n, [&](size_t i) {
+        for (size_t j = i; j < n && j - i < filled; j++) {
+            matrices.segment(i, j) *= factors[j - i + 1];
+            matrices.closed(i, j) *= factors[j - i + 1];
+        }
+    });
+    for (double& weight : matrices.pair_weights) {
+        weight *= std::exp(-2 * log_factor);
+    }
+    matrices.log_scale += log_factor;
+}
+
+/**
+ * @brief Fills the inside matrices of the partition function, diagonal by
+ * diagonal on the shared thread pool like create_matrix_parallel. The sum
+ * over k reads row i of Q and column j of Qb, both contiguous, with the
+ * vectorized sum_product. After each diagonal the scale is raised or lowered
+ * if its largest value drifted beyond 1e100 either way.
+ *
+ * @tparam Scoring scoring policy, see NussinovScoring
+ * @tparam Loop int, or LoopLength for a loop length fixed at compile time
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param temperature weight of a structure is exp(score / temperature)
+ * @param thread_count number of threads, 0 means one per core
+ * @return PartitionMatrices
+ */
+template <typename Scoring = NussinovScoring, typename Loop = int>
+PartitionMatrices create_partition_matrices(
+    const Sequence& rna_sequence, const Loop& minimal_loop_length = Loop(),
+    double temperature = 1.0, size_t thread_count = 0) {
+    const size_t n = rna_sequence.size();
+    PartitionMatrices matrices{TriangularMatrix<double>(n),
+                               ColumnTriangularMatrix<double>(n)};
+    matrices.minimal_loop_length = minimal_loop_length;
+    for (size_t pair = 0; pair < 16; pair++) {
+        const int score = Scoring::pair_scores[pair];
+        matrices.pair_weights[pair] =
+            score == 0 ? 0.0 : std::exp(score / temperature);
+    }
+
+    const size_t loop = minimal_loop_length;
+    ThreadPool& pool = ThreadPool::shared(thread_count);
+    for (size_t k = 0; k < n; k++) {
+        const double unpaired = std::exp(-matrices.log_scale);
+        pool.parallel_for(0, n - k, [&](size_t i) {
+            const size_t j = i + k;
+            double closed = 0;
+            if (k > loop) {
+                closed = matrices.pair_weight(rna_sequence, i, j) *
+                         matrices.inside(i + 1, j - 1);
+            }
+            matrices.closed(i, j) = closed;
+
+            double total = (k > 0 ? matrices.segment(i, j - 1) : 1.0) *
+                               unpaired +
+                           closed;
+            if (k > loop + 1) {
+                total += sum_product(matrices.segment.row(i),
+                                     matrices.closed.column(j) + i + 1,
+                                     k - loop - 1);
+            }
+            matrices.segment(i, j) = total;
+        });
+
+        double largest = 0;
+        for (size_t i = 0; i + k < n; i++) {
+            largest = std::max(largest, matrices.segment(i, i + k));
+        }
+        if (largest > 1e100 || (largest > 0 && largest < 1e-100)) {
+            rescale_partition(matrices, k + 1,
+                              std::log(largest) / double(k + 1), pool);
+        }
+    }
+
+    return matrices;
+}
+
+/**
+ * @brief Probabilities of the base pairs from the inside matrices, by an
+ * outside pass over the same decomposition. Only the pairs at or above
+ * cutoff are returned, sorted by i then j.
+ *
+ * The outside value of Q(i, j) depends on the row i to its right and on the
+ * outside values of the pairs (k, l) with k < i, which sum the outside
+ * values of the rows above. So the rows are walked from the left in blocks
+ * of block_rows, kept in a small buffer and swept together from the right,
+ * reading each column of Qb once per block; when a block is done its rows
+ * are added to the sums of the pairs below it, again reading each row of
+ * that triangle once per block. Together with the inside matrices that is
+ * three triangles of doubles, and the dense probabilities are never stored.
+ *
+ * @param matrices
+ * @param rna_sequence the sequence the matrices were filled for
+ * @param cutoff smallest probability kept
+ * @param thread_count number of threads, 0 means one per core
+ * @param block_rows rows of a block
+ * @return std::vector<PairProbability>
+ */
+std::vector<PairProbability> pair_probabilities(
+    const PartitionMatrices& matrices, const Sequence& rna_sequence,
+    double cutoff = 1e-5, size_t thread_count = 0, size_t block_rows = 32) {
+    const size_t n = rna_sequence.size();
+    std::vector<PairProbability> probabilities;
+    if (n == 0) {
+        return probabilities;
+    }
+
+    const size_t loop = matrices.minimal_loop_length;
+    const double unpaired = std::exp(-matrices.log_scale);
+    const double total = matrices.segment(0, n - 1);
+    ThreadPool& pool = ThreadPool::shared(thread_count);
+
+    // pair_outside(k, l) sums the outside values of Q(i, l) * Q(i, k - 1)
+    // over the rows i of the blocks done so far, which is the derivative of
+    // Q(0, n - 1) by Qb(k, l) once every row i <= k is in
+    TriangularMatrix<double> pair_outside(n);
+    std::vector<double> block(block_rows * n);
+
+    // Derivative by Qb(k, l), adding the rows first..k of the current block
+    auto pair_derivative = [&](size_t first, size_t k, size_t l) {
+        double derivative = pair_outside(k, l);
+        for (size_t i = first; i <= k; i++) {
+            derivative += block[(i - first) * n + l] *
+                          (i < k ? matrices.segment(i, k - 1) : 1.0);
+        }
+        return derivative;
+    };
+
+    for (size_t first = 0; first < n; first += block_rows) {
+        const size_t last = std::min(first + block_rows, n);
+        std::fill(block.begin(), block.end(), 0.0);
+        if (first == 0) {
+            block[n - 1] = 1.0;
+        }
+
+        // Q(i, j) is Q(i, j + 1) with j + 1 unpaired, the inside of the pair
+        // (i - 1, j + 1), or Q(i, k - 1) in front of the pair (k, j)
+        for (size_t j = n - 1; j + 1 > first; j--) {
+            for (size_t i = first; i < last && i <= j; i++) {
+                double* outside = block.data() + (i - first) * n;
+                if (j + 1 < n) {
+                    outside[j] += outside[j + 1] * unpaired;
+                    if (i > 0 && j + 2 - i > loop) {
+                        outside[j] += matrices.pair_weight(rna_sequence, i - 1,
+                                                           j + 1) *
+                                      pair_derivative(first, i - 1, j + 1);
+                    }
+                }
+                if (j - i > loop + 1) {
+                    add_product(outside + i, outside[j],
+                                matrices.closed.column(j) + i + 1,
+                                j - i - loop - 1);
+                }
+            }
+        }
+
+        for (size_t i = first; i < last; i++) {
+            for (size_t l = i + loop + 1; l < n; l++) {
+                const double probability = matrices.closed(i, l) *
+                                           pair_derivative(first, i, l) /
+                                           total;
+                if (probability >= cutoff) {
+                    probabilities.push_back({int(i), int(l), probability});
+                }
+            }
+        }
+
+        // Qb(k, l) follows Q(i, k - 1) inside Q(i, l). The last row of the
+        // block is included, as the first row of the next one reads it.
+        pool.parallel_for(last - 1, n, [&](size_t k) {
+            if (k + loop + 1 < n) {
+                for (size_t i = first; i < last && i <= k; i++) {
+                    add_product(&pair_outside(k, k + loop + 1),
+                                i < k ? matrices.segment(i, k - 1) : 1.0,
+                                block.data() + (i - first) * n + k + loop + 1,
+                                n - k - loop - 1);
+                }
+            }
+        });
+    }
+
+    return probabilities;
+}
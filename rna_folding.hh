@@ -7,95 +7,384 @@
  * 
  */
 
+#pragma once
+
 #include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <tuple>
 #include <vector>
 #include <fstream>
 #include "herrlog.hh"
+#include "scoring.hh"
+#include "sequence.hh"
+#include "simd_kernels.hh"
+#include "thread_pool.hh"
+#include "triangular_matrix.hh"
+
+/**
+ * @brief Checks whether every score of a sequence of the given length fits in
+ * Cell. A score is at most length / 2 pairs of max_pair_score each, and so
+ * is the sum of the two halves of a bifurcation.
+ *
+ * @tparam Cell
+ * @param length
+ * @param max_pair_score highest score of a pair, see max_pair_score()
+ * @return true if Cell is wide enough
+ */
+template <typename Cell>
+constexpr bool cell_type_fits(size_t length, int max_pair_score = 1) {
+    return length / 2 * max_pair_score <=
+           static_cast<size_t>(std::numeric_limits<Cell>::max());
+}
 
 /**
- * @brief Function to create the DP matrix for RNA folding
+ * @brief Calls visitor with a value of the narrowest cell type that can hold
+ * the scores of a sequence of the given length: uint8_t below 512
+ * nucleotides, int16_t below 65536 and int otherwise, for unit pair scores.
+ * Used to instantiate the engines with the cheapest matrix.
  *
+ * @tparam Visitor
+ * @param length
+ * @param visitor
+ * @param max_pair_score highest score of a pair, see max_pair_score()
+ * @return auto whatever visitor returns
+ */
+template <typename Visitor>
+auto with_cell_type(size_t length, Visitor visitor, int max_pair_score = 1) {
+    if (cell_type_fits<uint8_t>(length, max_pair_score)) {
+        return visitor(uint8_t());
+    }
+    if (cell_type_fits<int16_t>(length, max_pair_score)) {
+        return visitor(int16_t());
+    }
+    return visitor(int());
+}
+
+/**
+ * @brief Stops the program if the scores of a sequence of the given length do
+ * not fit in Cell. Done once per fill, so the cells themselves are never
+ * checked.
+ *
+ * @tparam Cell
+ * @param length
+ * @param max_pair_score highest score of a pair, see max_pair_score()
+ */
+template <typename Cell>
+void check_cell_type(size_t length, int max_pair_score = 1) {
+    if (!cell_type_fits<Cell>(length, max_pair_score)) {
+        Logger::error("A sequence of {} nucleotides does not fit in {} bit cells",
+                      length, 8 * sizeof(Cell));
+    }
+}
+
+/**
+ * @brief Codes stored in a TracebackMatrix, in the order traceback tries the
+ * rules. A code of first_split + m means the cell splits into (i, i + 1 + m)
+ * and (i + 2 + m, j).
+ *
+ */
+namespace traceback_step {
+inline constexpr uint16_t skip_left = 0;    // 1st rule, i stays unpaired
+inline constexpr uint16_t skip_right = 1;   // 2nd rule, j stays unpaired
+inline constexpr uint16_t close = 2;        // 3rd rule, i pairs with j
+inline constexpr uint16_t first_split = 3;  // 4th rule, bifurcation
+}  // namespace traceback_step
+
+//! Winning rule of every cell, recorded while filling the DP matrix
+using TracebackMatrix = TriangularMatrix<uint16_t>;
+
+/**
+ * @brief Checks whether the split points of a sequence of the given length
+ * can be stored in a TracebackMatrix
+ *
+ * @param length
+ * @return true if a TracebackMatrix can be recorded
+ */
+constexpr bool traceback_matrix_fits(size_t length) {
+    return length + traceback_step::first_split <=
+           std::numeric_limits<uint16_t>::max();
+}
+
+/**
+ * @brief Sets cell (i, j) of the DP matrix and of its transposed mirror from
+ * its neighbours and the already computed bifurcation maximum rc
+ *
+ * @tparam Cell
+ * @tparam Scoring scoring policy, see NussinovScoring
+ * @tparam Loop int, or LoopLength for a loop length fixed at compile time
+ * @param dp
+ * @param columns transposed mirror of dp
  * @param rna_sequence
- * @return int
+ * @param minimal_loop_length
+ * @param i
+ * @param j
+ * @param rc max over i <= t < j of dp(i, t) + dp(t + 1, j)
+ * @param steps if not null, the winning rule is recorded here
  */
-std::vector<std::vector<int>> create_matrix(
-    const std::string& rna_sequence, const int& minimal_loop_length = 0) {
-    std::vector<std::vector<int>> dp(rna_sequence.size(),
-                                     std::vector<int>(rna_sequence.size(), 0));
+template <typename Cell, typename Scoring = NussinovScoring,
+          typename Loop = int>
+inline void finish_cell(TriangularMatrix<Cell>& dp,
+                        ColumnTriangularMatrix<Cell>& columns,
+                        const Sequence& rna_sequence,
+                        const Loop& minimal_loop_length, size_t i, size_t j,
+                        Cell rc, TracebackMatrix* steps = nullptr) {
+    Cell value = 0;
+    Cell closed = 0;
+    if (j - i > minimal_loop_length) {
+        closed = Cell(dp.at(i + 1, j - 1) +
+                      pair_score<Scoring>(rna_sequence, i, j));
+        value = std::max({dp(i + 1, j), dp(i, j - 1), closed, rc});
+    }
+    dp(i, j) = value;
+    columns(i, j) = value;
+
+    if (steps == nullptr) {
+        return;
+    }
+    uint16_t step = traceback_step::skip_left;
+    if (value == dp(i + 1, j)) {
+        step = traceback_step::skip_left;
+    } else if (value == dp(i, j - 1)) {
+        step = traceback_step::skip_right;
+    } else if (value == closed) {
+        step = traceback_step::close;
+    } else {
+        // Same split traceback would pick: the first t with a matching sum
+        const Cell* row = dp.row(i);
+        const Cell* column = columns.column(j);
+        size_t t = i + 1;
+        while (t + 1 < j && Cell(row[t - i] + column[t + 1]) != value) {
+            t++;
+        }
+        step = traceback_step::first_split + (t - i - 1);
+    }
+    (*steps)(i, j) = step;
+}
+
+/**
+ * @brief Fills cell (i, j) of the DP matrix, every cell on a shorter diagonal
+ * must already be filled. The bifurcation rule reads row i of dp and column j
+ * of the mirror, both contiguous, with the vectorized max_plus.
+ *
+ * @tparam Cell
+ * @tparam Scoring scoring policy, see NussinovScoring
+ * @tparam Loop int, or LoopLength for a loop length fixed at compile time
+ * @param dp
+ * @param columns transposed mirror of dp
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param i
+ * @param j
+ * @param steps if not null, the winning rule is recorded here
+ */
+template <typename Cell, typename Scoring = NussinovScoring,
+          typename Loop = int>
+inline void fill_cell(TriangularMatrix<Cell>& dp,
+                      ColumnTriangularMatrix<Cell>& columns,
+                      const Sequence& rna_sequence,
+                      const Loop& minimal_loop_length, size_t i, size_t j,
+                      TracebackMatrix* steps = nullptr) {
+    Cell rc = std::numeric_limits<Cell>::min();
+    if (j - i > minimal_loop_length) {
+        rc = max_plus(dp.row(i), columns.column(j) + i + 1, j - i);
+    }
+    finish_cell<Cell, Scoring>(dp, columns, rna_sequence, minimal_loop_length,
+                               i, j, rc, steps);
+}
+
+/**
+ * @brief Function to create the DP matrix for RNA folding. Only the upper
+ * triangle (i <= j) is ever read, so it is stored packed. A transposed mirror
+ * is kept while filling so the bifurcation rule can be vectorized; it is
+ * dropped once the matrix is complete.
+ *
+ * The pair scores come from the Scoring policy and the loop length may be a
+ * LoopLength, both known at compile time, so every combination gets its own
+ * fill without any test of the policy per cell.
+ *
+ * @tparam Cell cell type, see with_cell_type for picking the narrowest one
+ * @tparam Scoring scoring policy, see NussinovScoring
+ * @tparam Loop int, or LoopLength for a loop length fixed at compile time
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param steps if not null, receives the winning rule of every cell
+ * @return TriangularMatrix<Cell>
+ */
+template <typename Cell = int, typename Scoring = NussinovScoring,
+          typename Loop = int>
+TriangularMatrix<Cell> create_matrix(const Sequence& rna_sequence,
+                                     const Loop& minimal_loop_length = Loop(),
+                                     TracebackMatrix* steps = nullptr) {
+    check_cell_type<Cell>(rna_sequence.size(), max_pair_score<Scoring>());
+    TriangularMatrix<Cell> dp(rna_sequence.size());
+    ColumnTriangularMatrix<Cell> columns(rna_sequence.size());
+    if (steps != nullptr) {
+        *steps = TracebackMatrix(rna_sequence.size());
+    }
 
     for (size_t k = 1; k < rna_sequence.size(); k++) {
         for (size_t i = 0; i < rna_sequence.size() - k; i++) {
-            size_t j = i + k;
+            fill_cell<Cell, Scoring>(dp, columns, rna_sequence,
+                                     minimal_loop_length, i, i + k, steps);
+        }
+    }
 
-            if (j - i > minimal_loop_length) {
-                int rc = INT32_MIN;
-                for (size_t t = i; t < j; t++) {
-                    rc = std::max(rc, dp[i][t] + dp[t + 1][j]);
-                }
+    return dp;
+}
 
-                dp[i][j] = std::max(
-                    {dp[i + 1][j], dp[i][j - 1],
-                     dp[i + 1][j - 1] +
-                         (rna_sequence[i] == 'A' && rna_sequence[j] == 'U' ||
-                          rna_sequence[i] == 'U' && rna_sequence[j] == 'A' ||
-                          rna_sequence[i] == 'C' && rna_sequence[j] == 'G' ||
-                          rna_sequence[i] == 'G' && rna_sequence[j] == 'C'),
-                     rc});
-            } else {
-                dp[i][j] = 0;
-            }
-        }
+/**
+ * @brief Parallel version of create_matrix. Every cell of a diagonal only
+ * depends on shorter diagonals, so each diagonal is split across the threads
+ * of a persistent pool. Sequences shorter than serial_threshold are filled
+ * serially, as the per diagonal synchronization would cost more than it
+ * saves.
+ *
+ * @tparam Cell cell type, see with_cell_type for picking the narrowest one
+ * @tparam Scoring scoring policy, see NussinovScoring
+ * @tparam Loop int, or LoopLength for a loop length fixed at compile time
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param thread_count number of threads, 0 means one per core
+ * @param serial_threshold
+ * @param steps if not null, receives the winning rule of every cell
+ * @return TriangularMatrix<Cell>
+ */
+template <typename Cell = int, typename Scoring = NussinovScoring,
+          typename Loop = int>
+TriangularMatrix<Cell> create_matrix_parallel(
+    const Sequence& rna_sequence, const Loop& minimal_loop_length = Loop(),
+    size_t thread_count = 0, size_t serial_threshold = 512,
+    TracebackMatrix* steps = nullptr) {
+    ThreadPool& pool = ThreadPool::shared(thread_count);
+    if (rna_sequence.size() < serial_threshold || pool.size() == 1) {
+        return create_matrix<Cell, Scoring>(rna_sequence, minimal_loop_length,
+                                            steps);
+    }
+
+    check_cell_type<Cell>(rna_sequence.size(), max_pair_score<Scoring>());
+    TriangularMatrix<Cell> dp(rna_sequence.size());
+    ColumnTriangularMatrix<Cell> columns(rna_sequence.size());
+    if (steps != nullptr) {
+        *steps = TracebackMatrix(rna_sequence.size());
+    }
+
+    for (size_t k = 1; k < rna_sequence.size(); k++) {
+        pool.parallel_for(0, rna_sequence.size() - k, [&](size_t i) {
+            fill_cell<Cell, Scoring>(dp, columns, rna_sequence,
+                                     minimal_loop_length, i, i + k, steps);
+        });
     }
 
     return dp;
 }
 
 /**
- * @brief Function to calculate number of bonds (theoretical) in the RNA
+ * @brief Function to calculate number of bonds (theoretical) in the RNA. The
+ * matrix uses the narrowest cell type that can hold the score.
  * 
+ * @tparam Scoring scoring policy, see NussinovScoring
  * @param rna_sequence 
  * @param minimal_loop_length 
  * @return int 
  */
-int rna_score(const std::string& rna_sequence,
+template <typename Scoring = NussinovScoring>
+int rna_score(const Sequence& rna_sequence,
               const int& minimal_loop_length = 0) {
-    std::vector<std::vector<int>> dp =
-        create_matrix(rna_sequence, minimal_loop_length);
-    return dp[0][rna_sequence.size() - 1];
+    if (rna_sequence.empty()) {
+        return 0;
+    }
+    return with_cell_type(
+        rna_sequence.size(),
+        [&](auto cell) {
+            using Cell = decltype(cell);
+            TriangularMatrix<Cell> dp = create_matrix<Cell, Scoring>(
+                rna_sequence, minimal_loop_length);
+            return static_cast<int>(dp(0, rna_sequence.size() - 1));
+        },
+        max_pair_score<Scoring>());
 }
 
 /**
- * @brief Function to traceback DP and get the bonds structure
+ * @brief Function to traceback DP and get the bonds structure. Walks the
+ * matrix with an explicit stack, so long sequences cannot overflow the call
+ * stack.
  * 
+ * @tparam Scoring scoring policy the matrix was filled with
+ * @tparam Matrix TriangularMatrix, or BandedMatrix within its span
  * @param nm 
  * @param rna 
  * @param fold 
  * @param i 
  * @param j 
  */
-void traceback(const std::vector<std::vector<int>>& nm, const std::string& rna,
+template <typename Scoring = NussinovScoring, typename Matrix>
+void traceback(const Matrix& nm, const Sequence& rna,
                std::vector<std::pair<int, int>>& fold, int i, int j) {
-    if (i < j) {
-        if (nm[i][j] == nm[i + 1][j]) {  // 1st rule
-            traceback(nm, rna, fold, i + 1, j);
-        } else if (nm[i][j] == nm[i][j - 1]) {  // 2nd rule
-            traceback(nm, rna, fold, i, j - 1);
-        } else if (nm[i][j] ==
-                   nm[i + 1][j - 1] +
-                       (rna[i] == 'A' && rna[j] == 'U' ||
-                        rna[i] == 'U' && rna[j] == 'A' ||
-                        rna[i] == 'C' && rna[j] == 'G' ||
-                        rna[i] == 'G' && rna[j] == 'C')) {  // 3rd rule
-            fold.push_back(std::make_pair(i, j));
-            traceback(nm, rna, fold, i + 1, j - 1);
-        } else {
-            for (int k = i + 1; k < j - 1; k++) {
-                if (nm[i][j] == nm[i][k] + nm[k + 1][j]) {  // 4th rule
-                    traceback(nm, rna, fold, i, k);
-                    traceback(nm, rna, fold, k + 1, j);
+    std::vector<std::pair<int, int>> pending = {{i, j}};
+    while (!pending.empty()) {
+        std::tie(i, j) = pending.back();
+        pending.pop_back();
+
+        while (i < j) {
+            if (nm.at(i, j) == nm.at(i + 1, j)) {  // 1st rule
+                i++;
+            } else if (nm.at(i, j) == nm.at(i, j - 1)) {  // 2nd rule
+                j--;
+            } else if (nm.at(i, j) == nm.at(i + 1, j - 1) +
+                                          pair_score<Scoring>(rna, i, j)) {
+                // 3rd rule
+                fold.push_back(std::make_pair(i, j));
+                i++;
+                j--;
+            } else {
+                int k = i + 1;
+                while (k < j - 1 &&
+                       nm.at(i, j) != nm.at(i, k) + nm.at(k + 1, j)) {
+                    k++;
+                }
+                if (k == j - 1) {
                     break;
                 }
+                pending.push_back({k + 1, j});  // 4th rule
+                j = k;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Function to traceback the bonds structure from the rules recorded
+ * while filling the matrix. Every step is a lookup, so the walk is linear in
+ * the size of the structure.
+ *
+ * @param steps
+ * @param fold
+ * @param i
+ * @param j
+ */
+void traceback(const TracebackMatrix& steps,
+               std::vector<std::pair<int, int>>& fold, int i, int j) {
+    std::vector<std::pair<int, int>> pending = {{i, j}};
+    while (!pending.empty()) {
+        std::tie(i, j) = pending.back();
+        pending.pop_back();
+
+        while (i < j) {
+            const uint16_t step = steps(i, j);
+            if (step == traceback_step::skip_left) {
+                i++;
+            } else if (step == traceback_step::skip_right) {
+                j--;
+            } else if (step == traceback_step::close) {
+                fold.push_back(std::make_pair(i, j));
+                i++;
+                j--;
+            } else {
+                int k = i + 1 + (step - traceback_step::first_split);
+                pending.push_back({k + 1, j});
+                j = k;
             }
         }
     }
@@ -108,7 +397,7 @@ void traceback(const std::vector<std::vector<int>>& nm, const std::string& rna,
  * @param fold 
  * @return std::string 
  */
-std::string dot_write(const std::string& rna,
+std::string dot_write(const Sequence& rna,
                       const std::vector<std::pair<int, int>>& fold) {
     std::string dot(rna.size(), '.');
 
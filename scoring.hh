@@ -0,0 +1,128 @@
+/**
+ * @file scoring.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Compile-time scoring policies for the DP engines
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <type_traits>
+#include "sequence.hh"
+
+/**
+ * @brief Unit Nussinov scoring: every Watson-Crick pair scores 1. This is the
+ * default of every engine.
+ *
+ * A scoring policy is any type with a constexpr name and a constexpr
+ * pair_scores table indexed like pair_table by (code(i) << 2) | code(j),
+ * holding the score of the pair (i, j), 0 if i and j cannot pair. As all of
+ * it is known at compile time, each policy gets a fully specialized fill.
+ *
+ */
+struct NussinovScoring {
+    static constexpr const char* name = "nussinov";
+    static constexpr std::array<uint8_t, 16> pair_scores = pair_table;
+};
+
+/**
+ * @brief Pairs weighted by their number of hydrogen bonds, G-C 3 and A-U 2,
+ * plus the G-U wobble pair scoring 1
+ *
+ */
+struct WeightedScoring {
+    static constexpr const char* name = "weighted";
+    static constexpr std::array<uint8_t, 16> pair_scores = {
+        //       A  C  G  U
+        /* A */ 0, 0, 0, 2,
+        /* C */ 0, 0, 3, 0,
+        /* G */ 0, 3, 0, 1,
+        /* U */ 2, 0, 1, 0,
+    };
+};
+
+/**
+ * @brief Minimal loop length fixed at compile time. Engines take the loop
+ * length as a template parameter too, so passing LoopLength<3>() instead of
+ * 3 lets the compiler fold the loop length test into the fill.
+ *
+ * @tparam Length
+ */
+template <int Length>
+using LoopLength = std::integral_constant<int, Length>;
+
+/**
+ * @brief Highest score of a single pair under Scoring, which bounds every
+ * score of a sequence of length n by n / 2 times it
+ *
+ * @tparam Scoring
+ * @return int
+ */
+template <typename Scoring>
+constexpr int max_pair_score() {
+    return *std::max_element(Scoring::pair_scores.begin(),
+                             Scoring::pair_scores.end());
+}
+
+/**
+ * @brief Score of the pair (i, j) under Scoring, 0 if one of them is
+ * unpairable. A table access and a mask, without branches.
+ *
+ * @tparam Scoring
+ * @param rna_sequence
+ * @param i
+ * @param j
+ * @return uint8_t
+ */
+template <typename Scoring>
+inline uint8_t pair_score(const Sequence& rna_sequence, size_t i, size_t j) {
+    return Scoring::pair_scores[(rna_sequence.code(i) << 2) |
+                                rna_sequence.code(j)] *
+           (rna_sequence.is_pairable(i) & rna_sequence.is_pairable(j));
+}
+
+/**
+ * @brief Scoring policies selectable at run time
+ *
+ */
+enum class ScoringModel {
+    Nussinov,  // NussinovScoring
+    Weighted,  // WeightedScoring
+};
+
+/**
+ * @brief Calls visitor with a value of the policy type of model, the run
+ * time counterpart of picking the policy as a template argument
+ *
+ * @tparam Visitor
+ * @param model
+ * @param visitor
+ * @return auto whatever visitor returns
+ */
+template <typename Visitor>
+auto with_scoring(ScoringModel model, Visitor visitor) {
+    switch (model) {
+        case ScoringModel::Weighted:
+            return visitor(WeightedScoring());
+        case ScoringModel::Nussinov:
+        default:
+            return visitor(NussinovScoring());
+    }
+}
+
+/**
+ * @brief Name of the policy of model
+ *
+ * @param model
+ * @return const char*
+ */
+inline const char* scoring_name(ScoringModel model) {
+    return with_scoring(model, [](auto scoring) {
+        return decltype(scoring)::name;
+    });
+}
@@ -0,0 +1,215 @@
+/**
+ * @file sequence.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Normalized, 2-bit packed RNA sequence with table-driven pairing
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//! Nucleotides in the order of their 2-bit codes
+inline constexpr std::array<char, 4> nucleotides = {'A', 'C', 'G', 'U'};
+
+/**
+ * @brief Pairing table indexed by (code(i) << 2) | code(j), 1 for the
+ * Watson-Crick pairs A-U, U-A, C-G and G-C
+ *
+ */
+inline constexpr std::array<uint8_t, 16> pair_table = {
+    //       A  C  G  U
+    /* A */ 0, 0, 0, 1,
+    /* C */ 0, 0, 1, 0,
+    /* G */ 0, 1, 0, 0,
+    /* U */ 1, 0, 0, 0,
+};
+
+/**
+ * @brief Brings a character of an input file to the alphabet the engines
+ * expect: uppercase, with T read as U. Whitespace, including the CR of CRLF
+ * files, becomes '\0' and should be skipped.
+ *
+ * @param c
+ * @return char
+ */
+inline char normalize_nucleotide(char c) {
+    if (std::isspace(static_cast<unsigned char>(c))) {
+        return '\0';
+    }
+    c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    return c == 'T' ? 'U' : c;
+}
+
+/**
+ * @brief 2-bit code of a normalized nucleotide, 4 for anything that is not
+ * one of A, C, G and U
+ *
+ * @param c
+ * @return uint8_t
+ */
+constexpr uint8_t nucleotide_code(char c) {
+    switch (c) {
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'U': return 3;
+        default: return 4;
+    }
+}
+
+/**
+ * @brief RNA sequence normalized once on construction and stored with 2 bits
+ * per nucleotide. A bitset marks the positions holding one of A, C, G and U;
+ * every other letter is kept as an unpairable position, read back as 'N'.
+ * Pair checks are two lookups and a table access, without branches.
+ *
+ */
+class Sequence {
+   private:
+    size_t n = 0;
+    std::vector<uint64_t> codes;     // 32 nucleotides per word
+    std::vector<uint64_t> pairable;  // 64 positions per word
+
+   public:
+    /**
+     * @brief Construct an empty sequence
+     *
+     */
+    Sequence() = default;
+
+    /**
+     * @brief Construct a new sequence from text, see normalize_nucleotide.
+     * Implicit so that the engines can still be called with a std::string.
+     *
+     * @param text
+     */
+    Sequence(const std::string& text) {
+        codes.reserve(text.size() / 32 + 1);
+        pairable.reserve(text.size() / 64 + 1);
+        for (char c : text) {
+            c = normalize_nucleotide(c);
+            if (c != '\0') {
+                push_back(c);
+            }
+        }
+    }
+
+    /**
+     * @brief Construct a new sequence from a C string
+     *
+     * @param text
+     */
+    Sequence(const char* text) : Sequence(std::string(text)) {}
+
+    /**
+     * @brief Appends a normalized nucleotide
+     *
+     * @param c
+     */
+    void push_back(char c) {
+        if (n % 64 == 0) {
+            pairable.push_back(0);
+        }
+        if (n % 32 == 0) {
+            codes.push_back(0);
+        }
+        const uint8_t code = nucleotide_code(c);
+        if (code < 4) {
+            codes[n / 32] |= uint64_t(code) << (2 * (n % 32));
+            pairable[n / 64] |= uint64_t(1) << (n % 64);
+        }
+        n++;
+    }
+
+    /**
+     * @brief Replaces the nucleotide at position i, c is normalized first
+     *
+     * @param i
+     * @param c
+     */
+    void set(size_t i, char c) {
+        const uint8_t code = nucleotide_code(normalize_nucleotide(c));
+        codes[i / 32] &= ~(uint64_t(3) << (2 * (i % 32)));
+        pairable[i / 64] &= ~(uint64_t(1) << (i % 64));
+        if (code < 4) {
+            codes[i / 32] |= uint64_t(code) << (2 * (i % 32));
+            pairable[i / 64] |= uint64_t(1) << (i % 64);
+        }
+    }
+
+    /**
+     * @brief Number of nucleotides
+     *
+     * @return size_t
+     */
+    size_t size() const { return n; }
+
+    /**
+     * @brief Whether the sequence has no nucleotide
+     *
+     * @return true if empty
+     */
+    bool empty() const { return n == 0; }
+
+    /**
+     * @brief 2-bit code of position i, 0 for unpairable positions
+     *
+     * @param i
+     * @return uint8_t
+     */
+    uint8_t code(size_t i) const {
+        return (codes[i / 32] >> (2 * (i % 32))) & 3;
+    }
+
+    /**
+     * @brief Whether position i holds one of A, C, G and U
+     *
+     * @param i
+     * @return true if position i can take part in a pair
+     */
+    bool is_pairable(size_t i) const {
+        return (pairable[i / 64] >> (i % 64)) & 1;
+    }
+
+    /**
+     * @brief Whether positions i and j can form a Watson-Crick pair
+     *
+     * @param i
+     * @param j
+     * @return true if they are complementary
+     */
+    bool can_pair(size_t i, size_t j) const {
+        return pair_table[(code(i) << 2) | code(j)] & is_pairable(i) &
+               is_pairable(j);
+    }
+
+    /**
+     * @brief Nucleotide at position i, 'N' for unpairable positions
+     *
+     * @param i
+     * @return char
+     */
+    char operator[](size_t i) const {
+        return is_pairable(i) ? nucleotides[code(i)] : 'N';
+    }
+
+    /**
+     * @brief Nucleotides of the sequence as text
+     *
+     * @return std::string
+     */
+    std::string to_string() const {
+        std::string text(n, 'N');
+        for (size_t i = 0; i < n; i++) {
+            text[i] = (*this)[i];
+        }
+        return text;
+    }
+};
@@ -0,0 +1,559 @@
+/**
+ * @file simd_kernels.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Vectorized max-plus and sum-product reductions used for the
+ * bifurcation rule
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RNA_FOLDING_X86 1
+#endif
+
+/**
+ * @brief Plain C++ version of max_plus, used when no vector unit is available
+ *
+ * @tparam Cell
+ * @param a
+ * @param b
+ * @param length
+ * @return Cell
+ */
+template <typename Cell>
+inline Cell max_plus_scalar(const Cell* a, const Cell* b, size_t length) {
+    Cell best = std::numeric_limits<Cell>::min();
+    for (size_t k = 0; k < length; k++) {
+        best = std::max(best, Cell(a[k] + b[k]));
+    }
+    return best;
+}
+
+/**
+ * @brief Plain C++ version of max_plus_accumulate
+ *
+ * @tparam Cell
+ * @param best
+ * @param left
+ * @param b
+ * @param length
+ */
+template <typename Cell>
+inline void max_plus_accumulate_scalar(Cell* best, Cell left, const Cell* b,
+                                       size_t length) {
+    for (size_t k = 0; k < length; k++) {
+        best[k] = std::max(best[k], Cell(left + b[k]));
+    }
+}
+
+#ifdef RNA_FOLDING_X86
+#define RNA_FOLDING_AVX2 __attribute__((target("avx2")))
+#define RNA_FOLDING_SSE4 __attribute__((target("sse4.1")))
+
+// Lane wise operations, overloaded on the cell type through the last argument
+
+RNA_FOLDING_AVX2 inline __m256i avx2_set1(int value, int) {
+    return _mm256_set1_epi32(value);
+}
+RNA_FOLDING_AVX2 inline __m256i avx2_set1(int16_t value, int16_t) {
+    return _mm256_set1_epi16(value);
+}
+RNA_FOLDING_AVX2 inline __m256i avx2_set1(uint8_t value, uint8_t) {
+    return _mm256_set1_epi8(static_cast<char>(value));
+}
+RNA_FOLDING_AVX2 inline __m256i avx2_add(__m256i x, __m256i y, int) {
+    return _mm256_add_epi32(x, y);
+}
+RNA_FOLDING_AVX2 inline __m256i avx2_add(__m256i x, __m256i y, int16_t) {
+    return _mm256_add_epi16(x, y);
+}
+RNA_FOLDING_AVX2 inline __m256i avx2_add(__m256i x, __m256i y, uint8_t) {
+    return _mm256_add_epi8(x, y);
+}
+RNA_FOLDING_AVX2 inline __m256i avx2_max(__m256i x, __m256i y, int) {
+    return _mm256_max_epi32(x, y);
+}
+RNA_FOLDING_AVX2 inline __m256i avx2_max(__m256i x, __m256i y, int16_t) {
+    return _mm256_max_epi16(x, y);
+}
+RNA_FOLDING_AVX2 inline __m256i avx2_max(__m256i x, __m256i y, uint8_t) {
+    return _mm256_max_epu8(x, y);
+}
+
+RNA_FOLDING_SSE4 inline __m128i sse4_set1(int value, int) {
+    return _mm_set1_epi32(value);
+}
+RNA_FOLDING_SSE4 inline __m128i sse4_set1(int16_t value, int16_t) {
+    return _mm_set1_epi16(value);
+}
+RNA_FOLDING_SSE4 inline __m128i sse4_set1(uint8_t value, uint8_t) {
+    return _mm_set1_epi8(static_cast<char>(value));
+}
+RNA_FOLDING_SSE4 inline __m128i sse4_add(__m128i x, __m128i y, int) {
+    return _mm_add_epi32(x, y);
+}
+RNA_FOLDING_SSE4 inline __m128i sse4_add(__m128i x, __m128i y, int16_t) {
+    return _mm_add_epi16(x, y);
+}
+RNA_FOLDING_SSE4 inline __m128i sse4_add(__m128i x, __m128i y, uint8_t) {
+    return _mm_add_epi8(x, y);
+}
+RNA_FOLDING_SSE4 inline __m128i sse4_max(__m128i x, __m128i y, int) {
+    return _mm_max_epi32(x, y);
+}
+RNA_FOLDING_SSE4 inline __m128i sse4_max(__m128i x, __m128i y, int16_t) {
+    return _mm_max_epi16(x, y);
+}
+RNA_FOLDING_SSE4 inline __m128i sse4_max(__m128i x, __m128i y, uint8_t) {
+    return _mm_max_epu8(x, y);
+}
+
+/**
+ * @brief Largest lane of a 128 bit vector, by folding the upper half onto the
+ * lower one until a single lane is left
+ *
+ * @tparam Cell
+ * @param x
+ * @return Cell
+ */
+template <typename Cell>
+RNA_FOLDING_SSE4 inline Cell sse4_reduce_max(__m128i x) {
+    x = sse4_max(x, _mm_srli_si128(x, 8), Cell());
+    x = sse4_max(x, _mm_srli_si128(x, 4), Cell());
+    if constexpr (sizeof(Cell) <= 2) {
+        x = sse4_max(x, _mm_srli_si128(x, 2), Cell());
+    }
+    if constexpr (sizeof(Cell) == 1) {
+        x = sse4_max(x, _mm_srli_si128(x, 1), Cell());
+    }
+    return static_cast<Cell>(_mm_cvtsi128_si32(x));
+}
+
+/**
+ * @brief AVX2 version of max_plus, 32 / sizeof(Cell) lanes at a time
+ *
+ * @tparam Cell
+ * @param a
+ * @param b
+ * @param length
+ * @return Cell
+ */
+template <typename Cell>
+RNA_FOLDING_AVX2 inline Cell max_plus_avx2(const Cell* a, const Cell* b,
+                                           size_t length) {
+    constexpr size_t lanes = sizeof(__m256i) / sizeof(Cell);
+    __m256i best = avx2_set1(std::numeric_limits<Cell>::min(), Cell());
+    size_t k = 0;
+    for (; k + lanes <= length; k += lanes) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k));
+        best = avx2_max(best, avx2_add(x, y, Cell()), Cell());
+    }
+
+    Cell result = sse4_reduce_max<Cell>(
+        sse4_max(_mm256_castsi256_si128(best),
+                 _mm256_extracti128_si256(best, 1), Cell()));
+    for (; k < length; k++) {
+        result = std::max(result, Cell(a[k] + b[k]));
+    }
+    return result;
+}
+
+/**
+ * @brief SSE4.1 version of max_plus, 16 / sizeof(Cell) lanes at a time
+ *
+ * @tparam Cell
+ * @param a
+ * @param b
+ * @param length
+ * @return Cell
+ */
+template <typename Cell>
+RNA_FOLDING_SSE4 inline Cell max_plus_sse4(const Cell* a, const Cell* b,
+                                           size_t length) {
+    constexpr size_t lanes = sizeof(__m128i) / sizeof(Cell);
+    __m128i best = sse4_set1(std::numeric_limits<Cell>::min(), Cell());
+    size_t k = 0;
+    for (; k + lanes <= length; k += lanes) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k));
+        best = sse4_max(best, sse4_add(x, y, Cell()), Cell());
+    }
+
+    Cell result = sse4_reduce_max<Cell>(best);
+    for (; k < length; k++) {
+        result = std::max(result, Cell(a[k] + b[k]));
+    }
+    return result;
+}
+
+/**
+ * @brief AVX2 version of max_plus_accumulate
+ *
+ * @tparam Cell
+ * @param best
+ * @param left
+ * @param b
+ * @param length
+ */
+template <typename Cell>
+RNA_FOLDING_AVX2 inline void max_plus_accumulate_avx2(Cell* best, Cell left,
+                                                      const Cell* b,
+                                                      size_t length) {
+    constexpr size_t lanes = sizeof(__m256i) / sizeof(Cell);
+    const __m256i x = avx2_set1(left, Cell());
+    size_t k = 0;
+    for (; k + lanes <= length; k += lanes) {
+        __m256i* target = reinterpret_cast<__m256i*>(best + k);
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k));
+        _mm256_storeu_si256(
+            target, avx2_max(_mm256_loadu_si256(target),
+                             avx2_add(x, y, Cell()), Cell()));
+    }
+    for (; k < length; k++) {
+        best[k] = std::max(best[k], Cell(left + b[k]));
+    }
+}
+
+/**
+ * @brief SSE4.1 version of max_plus_accumulate
+ *
+ * @tparam Cell
+ * @param best
+ * @param left
+ * @param b
+ * @param length
+ */
+template <typename Cell>
+RNA_FOLDING_SSE4 inline void max_plus_accumulate_sse4(Cell* best, Cell left,
+                                                      const Cell* b,
+                                                      size_t length) {
+    constexpr size_t lanes = sizeof(__m128i) / sizeof(Cell);
+    const __m128i x = sse4_set1(left, Cell());
+    size_t k = 0;
+    for (; k + lanes <= length; k += lanes) {
+        __m128i* target = reinterpret_cast<__m128i*>(best + k);
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k));
+        _mm_storeu_si128(target, sse4_max(_mm_loadu_si128(target),
+                                          sse4_add(x, y, Cell()), Cell()));
+    }
+    for (; k < length; k++) {
+        best[k] = std::max(best[k], Cell(left + b[k]));
+    }
+}
+#endif
+
+//! Signature shared by all max_plus implementations
+template <typename Cell>
+using MaxPlusKernel = Cell (*)(const Cell*, const Cell*, size_t);
+
+//! Signature shared by all max_plus_accumulate implementations
+template <typename Cell>
+using MaxPlusAccumulateKernel = void (*)(Cell*, Cell, const Cell*, size_t);
+
+/**
+ * @brief Picks the widest max_plus implementation the running CPU supports
+ *
+ * @tparam Cell
+ * @return MaxPlusKernel<Cell>
+ */
+template <typename Cell>
+inline MaxPlusKernel<Cell> select_max_plus_kernel() {
+#ifdef RNA_FOLDING_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return max_plus_avx2<Cell>;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return max_plus_sse4<Cell>;
+    }
+#endif
+    return max_plus_scalar<Cell>;
+}
+
+/**
+ * @brief Picks the widest max_plus_accumulate implementation the running CPU
+ * supports
+ *
+ * @tparam Cell
+ * @return MaxPlusAccumulateKernel<Cell>
+ */
+template <typename Cell>
+inline MaxPlusAccumulateKernel<Cell> select_max_plus_accumulate_kernel() {
+#ifdef RNA_FOLDING_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return max_plus_accumulate_avx2<Cell>;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return max_plus_accumulate_sse4<Cell>;
+    }
+#endif
+    return max_plus_accumulate_scalar<Cell>;
+}
+
+/**
+ * @brief Computes max over 0 <= k < length of a[k] + b[k], the smallest Cell
+ * if length is 0. The implementation is chosen once, on first use. Cell is
+ * one of uint8_t, int16_t and int; the sums must fit in Cell.
+ *
+ * @tparam Cell
+ * @param a
+ * @param b
+ * @param length
+ * @return Cell
+ */
+template <typename Cell>
+inline Cell max_plus(const Cell* a, const Cell* b, size_t length) {
+    static const MaxPlusKernel<Cell> kernel = select_max_plus_kernel<Cell>();
+    return kernel(a, b, length);
+}
+
+/**
+ * @brief Sets best[k] = max(best[k], left + b[k]) for 0 <= k < length. This
+ * is one row of a max-plus matrix product.
+ *
+ * @tparam Cell
+ * @param best
+ * @param left
+ * @param b
+ * @param length
+ */
+template <typename Cell>
+inline void max_plus_accumulate(Cell* best, Cell left, const Cell* b,
+                                size_t length) {
+    static const MaxPlusAccumulateKernel<Cell> kernel =
+        select_max_plus_accumulate_kernel<Cell>();
+    kernel(best, left, b, length);
+}
+
+/**
+ * @brief Plain C++ version of sum_product, with four partial sums so that
+ * the additions of consecutive terms do not wait on each other
+ *
+ * @param a
+ * @param b
+ * @param length
+ * @return double
+ */
+inline double sum_product_scalar(const double* a, const double* b,
+                                 size_t length) {
+    double sums[4] = {0, 0, 0, 0};
+    size_t k = 0;
+    for (; k + 4 <= length; k += 4) {
+        for (size_t lane = 0; lane < 4; lane++) {
+            sums[lane] += a[k + lane] * b[k + lane];
+        }
+    }
+    for (; k < length; k++) {
+        sums[0] += a[k] * b[k];
+    }
+    return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+/**
+ * @brief Plain C++ version of add_product
+ *
+ * @param target
+ * @param factor
+ * @param b
+ * @param length
+ */
+inline void add_product_scalar(double* target, double factor, const double* b,
+                               size_t length) {
+    for (size_t k = 0; k < length; k++) {
+        target[k] += factor * b[k];
+    }
+}
+
+#ifdef RNA_FOLDING_X86
+/**
+ * @brief AVX2 version of sum_product, two vectors of 4 partial sums
+ *
+ * @param a
+ * @param b
+ * @param length
+ * @return double
+ */
+RNA_FOLDING_AVX2 inline double sum_product_avx2(const double* a,
+                                                const double* b,
+                                                size_t length) {
+    __m256d first = _mm256_setzero_pd();
+    __m256d second = _mm256_setzero_pd();
+    size_t k = 0;
+    for (; k + 8 <= length; k += 8) {
+        first = _mm256_add_pd(first, _mm256_mul_pd(_mm256_loadu_pd(a + k),
+                                                   _mm256_loadu_pd(b + k)));
+        second = _mm256_add_pd(
+            second, _mm256_mul_pd(_mm256_loadu_pd(a + k + 4),
+                                  _mm256_loadu_pd(b + k + 4)));
+    }
+    const __m256d sums = _mm256_add_pd(first, second);
+    const __m128d half = _mm_add_pd(_mm256_castpd256_pd128(sums),
+                                    _mm256_extractf128_pd(sums, 1));
+    double result =
+        _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+    for (; k < length; k++) {
+        result += a[k] * b[k];
+    }
+    return result;
+}
+
+/**
+ * @brief AVX2 version of add_product
+ *
+ * @param target
+ * @param factor
+ * @param b
+ * @param length
+ */
+RNA_FOLDING_AVX2 inline void add_product_avx2(double* target, double factor,
+                                              const double* b, size_t length) {
+    const __m256d x = _mm256_set1_pd(factor);
+    size_t k = 0;
+    for (; k + 4 <= length; k += 4) {
+        const __m256d y = _mm256_mul_pd(x, _mm256_loadu_pd(b + k));
+        _mm256_storeu_pd(target + k,
+                         _mm256_add_pd(_mm256_loadu_pd(target + k), y));
+    }
+    for (; k < length; k++) {
+        target[k] += factor * b[k];
+    }
+}
+#endif
+
+/**
+ * @brief Computes the sum over 0 <= k < length of a[k] * b[k], the sum-product
+ * counterpart of max_plus used by the partition function. The implementation
+ * is chosen once, on first use.
+ *
+ * @param a
+ * @param b
+ * @param length
+ * @return double
+ */
+inline double sum_product(const double* a, const double* b, size_t length) {
+    using Kernel = double (*)(const double*, const double*, size_t);
+    static const Kernel kernel = [] {
+#ifdef RNA_FOLDING_X86
+        if (__builtin_cpu_supports("avx2")) {
+            return Kernel(sum_product_avx2);
+        }
+#endif
+        return Kernel(sum_product_scalar);
+    }();
+    return kernel(a, b, length);
+}
+
+/**
+ * @brief Sets target[k] += factor * b[k] for 0 <= k < length, the sum-product
+ * counterpart of max_plus_accumulate
+ *
+ * @param target
+ * @param factor
+ * @param b
+ * @param length
+ */
+inline void add_product(double* target, double factor, const double* b,
+                        size_t length) {
+    using Kernel = void (*)(double*, double, const double*, size_t);
+    static const Kernel kernel = [] {
+#ifdef RNA_FOLDING_X86
+        if (__builtin_cpu_supports("avx2")) {
+            return Kernel(add_product_avx2);
+        }
+#endif
+        return Kernel(add_product_scalar);
+    }();
+    kernel(target, factor, b, length);
+}
+
+/**
+ * @brief Plain C++ version of find_sum
+ *
+ * @param a
+ * @param b
+ * @param c
+ * @param target
+ * @param length
+ * @return size_t
+ */
+inline size_t find_sum_scalar(const int* a, const int* b, const int* c,
+                              int target, size_t length) {
+    for (size_t k = 0; k < length; k++) {
+        if (c[k] > 0 && a[k] + b[k] + c[k] == target) {
+            return k;
+        }
+    }
+    return length;
+}
+
+#ifdef RNA_FOLDING_X86
+/**
+ * @brief AVX2 version of find_sum, testing 8 positions at once
+ *
+ * @param a
+ * @param b
+ * @param c
+ * @param target
+ * @param length
+ * @return size_t
+ */
+RNA_FOLDING_AVX2 inline size_t find_sum_avx2(const int* a, const int* b,
+                                             const int* c, int target,
+                                             size_t length) {
+    const __m256i wanted = _mm256_set1_epi32(target);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t k = 0;
+    for (; k + 8 <= length; k += 8) {
+        const __m256i third =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + k));
+        const __m256i sum = _mm256_add_epi32(
+            _mm256_add_epi32(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k)),
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k))),
+            third);
+        const __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi32(sum, wanted),
+                                             _mm256_cmpgt_epi32(third, zero));
+        const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+        if (mask != 0) {
+            return k + __builtin_ctz(mask);
+        }
+    }
+    return k + find_sum_scalar(a + k, b + k, c + k, target, length - k);
+}
+#endif
+
+/**
+ * @brief Finds the first 0 <= k < length with c[k] > 0 and
+ * a[k] + b[k] + c[k] == target, length if there is none. Used to find the
+ * pairs that reach the optimum of a cell, which are few, without testing
+ * them one at a time.
+ *
+ * @param a
+ * @param b
+ * @param c
+ * @param target
+ * @param length
+ * @return size_t
+ */
+inline size_t find_sum(const int* a, const int* b, const int* c, int target,
+                       size_t length) {
+    using Kernel = size_t (*)(const int*, const int*, const int*, int, size_t);
+    static const Kernel kernel = [] {
+#ifdef RNA_FOLDING_X86
+        if (__builtin_cpu_supports("avx2")) {
+            return Kernel(find_sum_avx2);
+        }
+#endif
+        return Kernel(find_sum_scalar);
+    }();
+    return kernel(a, b, c, target, length);
+}
@@ -0,0 +1,71 @@
+/**
+ * @file sparse_engine.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief DP fill that only visits the split points closing a possible pair
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "rna_folding.hh"
+#include "sequence.hh"
+#include "simd_kernels.hh"
+
+/**
+ * @brief Sparse version of create_matrix. In an optimal structure of i..j,
+ * either j is unpaired, giving dp(i, j - 1), or j pairs with some k, giving
+ * dp(i, k - 1) + 1 + dp(k + 1, j - 1). Only the k complementary to j and far
+ * enough from it for the minimal loop length can pair, so these candidates
+ * are the only split points visited. Produces the same matrix as
+ * create_matrix.
+ *
+ * A column only depends on earlier columns, so it is filled at once: every
+ * candidate k adds dp(k + 1, j - 1) + 1 to column k - 1 of the mirror, and
+ * the whole column is folded into the running maximum with the vectorized
+ * max_plus_accumulate. On random sequences about a quarter of the split
+ * points are candidates, and far fewer on AU- or GC-skewed ones.
+ *
+ * @tparam Cell cell type, see with_cell_type for picking the narrowest one
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @return TriangularMatrix<Cell>
+ */
+template <typename Cell = int>
+TriangularMatrix<Cell> create_matrix_sparse(const Sequence& rna_sequence,
+                                            const int& minimal_loop_length = 0) {
+    const size_t n = rna_sequence.size();
+    check_cell_type<Cell>(n);
+    TriangularMatrix<Cell> dp(n);
+    ColumnTriangularMatrix<Cell> columns(n);
+    std::vector<Cell> best(n);
+
+    for (size_t j = 1; j < n; j++) {
+        // j unpaired
+        const Cell* previous = columns.column(j - 1);
+        std::copy(previous, previous + j, best.begin());
+
+        // j paired with a candidate k
+        for (size_t k = 0; k + minimal_loop_length < j; k++) {
+            if (!rna_sequence.can_pair(k, j)) {
+                continue;
+            }
+            const Cell closed = (k + 1 < j ? previous[k + 1] : Cell(0)) + 1;
+            if (k > 0) {
+                max_plus_accumulate(best.data(), closed, columns.column(k - 1),
+                                    k);
+            }
+            best[k] = std::max(best[k], closed);
+        }
+
+        for (size_t i = 0; i < j; i++) {
+            dp(i, j) = best[i];
+            columns(i, j) = best[i];
+        }
+    }
+
+    return dp;
+}
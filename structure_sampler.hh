@@ -0,0 +1,157 @@
+/**
+ * @file structure_sampler.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Sampling structures from the ensemble of the partition function
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "partition_function.hh"
+#include "rna_folding.hh"
+#include "sequence.hh"
+#include "thread_pool.hh"
+
+/**
+ * @brief Draws structures with probability proportional to their weight in
+ * the partition function, by a stochastic traceback of the inside matrices.
+ *
+ * Q(i, j) is the sum of its terms, Q(i, j - 1) with j unpaired and
+ * Q(i, k - 1) * Qb(k, j) for each partner k, so a uniform draw in
+ * [0, Q(i, j)) picks a term by summing them until the draw is passed. Every
+ * term is a product of two cells the fill already stored, so nothing is
+ * recomputed; the partners are tried from both ends of the segment in turn,
+ * which finds the likely ones after a few terms whichever end they sit at,
+ * and a sample usually costs far less than the O(n^2) worst case.
+ *
+ * The sampler only reads the matrices, so any number of threads may sample
+ * from one sampler at once.
+ *
+ */
+class StructureSampler {
+   private:
+    const PartitionMatrices& matrices;
+    const Sequence& rna_sequence;
+    size_t loop;
+    double unpaired;
+
+    /**
+     * @brief Term of the partner k of j in Q(i, j)
+     *
+     * @param i
+     * @param k
+     * @param j
+     * @return double
+     */
+    double pair_term(size_t i, size_t k, size_t j) const {
+        return (k > i ? matrices.segment(i, k - 1) : 1.0) *
+               matrices.closed(k, j);
+    }
+
+   public:
+    /**
+     * @brief Samples from filled inside matrices, both of which must outlive
+     * the sampler
+     *
+     * @param matrices
+     * @param rna_sequence the sequence the matrices were filled for
+     */
+    StructureSampler(const PartitionMatrices& matrices,
+                     const Sequence& rna_sequence)
+        : matrices(matrices),
+          rna_sequence(rna_sequence),
+          loop(matrices.minimal_loop_length),
+          unpaired(std::exp(-matrices.log_scale)) {}
+
+    /**
+     * @brief Draws one structure
+     *
+     * @tparam Random uniform random bit generator, such as std::mt19937_64
+     * @param random
+     * @return std::vector<std::pair<int, int>> base pairs
+     */
+    template <typename Random>
+    std::vector<std::pair<int, int>> sample(Random& random) const {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        std::vector<std::pair<int, int>> fold;
+        std::vector<std::pair<size_t, size_t>> pending;
+        if (!rna_sequence.empty()) {
+            pending.push_back({0, rna_sequence.size() - 1});
+        }
+
+        while (!pending.empty()) {
+            auto [i, j] = pending.back();
+            pending.pop_back();
+
+            while (j > i + loop) {
+                double draw = uniform(random) * matrices.segment(i, j);
+                const double skip = matrices.segment(i, j - 1) * unpaired;
+                if (draw < skip) {
+                    j--;
+                    continue;
+                }
+                draw -= skip;
+
+                // Partners from both ends in turn; rounding may leave the
+                // draw unspent, then the last partner with a weight is taken
+                size_t low = i;
+                size_t high = j - loop - 1;
+                size_t partner = j;
+                for (size_t tried = 0; tried <= j - loop - 1 - i; tried++) {
+                    const size_t k = tried % 2 == 0 ? low++ : high--;
+                    const double term = pair_term(i, k, j);
+                    if (term > 0) {
+                        partner = k;
+                        draw -= term;
+                        if (draw < 0) {
+                            break;
+                        }
+                    }
+                }
+                if (partner == j) {
+                    j--;
+                    continue;
+                }
+
+                fold.push_back({int(partner), int(j)});
+                if (partner + 1 < j - 1) {
+                    pending.push_back({partner + 1, j - 1});
+                }
+                if (partner == i) {
+                    break;
+                }
+                j = partner - 1;
+            }
+        }
+        return fold;
+    }
+
+    /**
+     * @brief Draws count structures on the shared thread pool. Sample s uses
+     * its own generator seeded with seed and s, so the result does not depend
+     * on the number of threads.
+     *
+     * @param count
+     * @param seed
+     * @param thread_count number of threads, 0 means one per core
+     * @return std::vector<std::string> dot-bracket structures
+     */
+    std::vector<std::string> sample_many(size_t count, uint64_t seed = 0,
+                                         size_t thread_count = 0) const {
+        std::vector<std::string> structures(count);
+        ThreadPool::shared(thread_count).parallel_for(0, count, [&](size_t s) {
+            std::seed_seq sequence{seed, uint64_t(s)};
+            std::mt19937_64 random(sequence);
+            structures[s] = dot_write(rna_sequence, sample(random));
+        });
+        return structures;
+    }
+};
@@ -0,0 +1,196 @@
+/**
+ * @file suboptimal.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Enumerating structures in order of score, best first
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "generator.hh"
+#include "scoring.hh"
+#include "sequence.hh"
+
+/**
+ * @brief One structure of the enumeration and its score
+ *
+ */
+struct SuboptimalStructure {
+    int score;
+    std::vector<std::pair<int, int>> pairs;  // sorted by opening position
+};
+
+/**
+ * @brief Node of an immutable singly linked list. Partial tracebacks that
+ * branch from a common ancestor share its pairs and pending segments instead
+ * of copying them.
+ *
+ * @tparam T
+ */
+template <typename T>
+struct SharedList {
+    T value;
+    std::shared_ptr<const SharedList> next;
+
+    /**
+     * @brief List with value in front of next
+     *
+     * @param value
+     * @param next
+     * @return std::shared_ptr<const SharedList>
+     */
+    static std::shared_ptr<const SharedList> push(
+        T value, std::shared_ptr<const SharedList> next) {
+        return std::make_shared<const SharedList>(
+            SharedList{std::move(value), std::move(next)});
+    }
+};
+
+/**
+ * @brief Enumerates the structures of a sequence in non-increasing score
+ * order, every distinct structure once, lazily as the caller reads them.
+ *
+ * A partial traceback holds the pairs chosen so far and the segments still
+ * to decide; its bound, the chosen scores plus dp of those segments, is the
+ * best score of any structure completing it. A segment (i, j) is decided by
+ * one of its alternatives, j unpaired or j paired with some k, and these
+ * are sorted by the score they allow. Partial tracebacks wait in a priority
+ * queue on their bound. The best one is completed along the first
+ * alternative of every segment, which keeps the bound, and each segment
+ * passed on the way leaves a single entry for its next alternative in the
+ * queue. So every structure read adds at most one entry per segment of its
+ * traceback, and a caller that stops after 10 structures has paid for 10
+ * tracebacks however many structures exist.
+ *
+ * The matrix and the sequence are read while the generator is consumed and
+ * must outlive it.
+ *
+ * @tparam Scoring scoring policy the matrix was filled with
+ * @tparam Matrix TriangularMatrix, or anything with the at() of traceback
+ * @param dp filled matrix of create_matrix
+ * @param rna_sequence
+ * @param minimal_loop_length the one the matrix was filled with
+ * @return Generator<SuboptimalStructure>
+ */
+template <typename Scoring = NussinovScoring, typename Matrix>
+Generator<SuboptimalStructure> suboptimal_structures(
+    const Matrix& dp, const Sequence& rna_sequence, int minimal_loop_length) {
+    using Segment = std::pair<size_t, size_t>;
+    using Pairs = std::shared_ptr<const SharedList<std::pair<int, int>>>;
+    using Segments = std::shared_ptr<const SharedList<Segment>>;
+
+    const size_t n = rna_sequence.size();
+    const size_t loop = minimal_loop_length;
+    auto value = [&](size_t i, size_t j) {
+        return i > j ? 0 : int(dp.at(i, j));
+    };
+
+    // Alternatives of a segment, best first, as (score, partner of j) with j
+    // itself standing for unpaired
+    std::unordered_map<uint64_t, std::vector<std::pair<int, size_t>>> cache;
+    auto alternatives =
+        [&](size_t i, size_t j) -> const std::vector<std::pair<int, size_t>>& {
+        auto [entry, inserted] = cache.try_emplace(uint64_t(i) * n + j);
+        std::vector<std::pair<int, size_t>>& choices = entry->second;
+        if (inserted) {
+            choices.push_back({value(i, j - 1), j});
+            for (size_t k = i; k + loop < j; k++) {
+                const int score = pair_score<Scoring>(rna_sequence, k, j);
+                if (score > 0) {
+                    choices.push_back(
+                        {(k > i ? value(i, k - 1) : 0) + value(k + 1, j - 1) +
+                             score,
+                         k});
+                }
+            }
+            std::stable_sort(
+                choices.begin(), choices.end(),
+                [](const auto& a, const auto& b) { return a.first > b.first; });
+        }
+        return choices;
+    };
+
+    // Segments too short to hold a pair are left out of the pending list
+    auto with_segment = [&](Segments pending, size_t i, size_t j) {
+        return i <= j && j - i > loop
+                   ? SharedList<Segment>::push({i, j}, std::move(pending))
+                   : pending;
+    };
+
+    struct Entry {
+        int bound;
+        uint64_t order;  // first in first out among equal bounds
+        Pairs pairs;
+        Segments pending;  // without the segment being decided
+        size_t i, j;
+        size_t alternative;
+
+        bool operator<(const Entry& other) const {
+            return bound != other.bound ? bound < other.bound
+                                        : order > other.order;
+        }
+    };
+    std::priority_queue<Entry> queue;
+    uint64_t order = 0;
+
+    if (n == 0 || n - 1 <= loop) {
+        co_yield SuboptimalStructure{0, {}};
+        co_return;
+    }
+    queue.push({value(0, n - 1), order++, nullptr, nullptr, 0, n - 1, 0});
+
+    while (!queue.empty()) {
+        Entry entry = queue.top();
+        queue.pop();
+
+        Pairs pairs = entry.pairs;
+        Segments pending = entry.pending;
+        size_t i = entry.i;
+        size_t j = entry.j;
+        size_t alternative = entry.alternative;
+        const int bound = entry.bound;
+        while (true) {
+            const auto& choices = alternatives(i, j);
+            const int rest = bound - choices[alternative].first;
+            if (alternative + 1 < choices.size()) {
+                queue.push({rest + choices[alternative + 1].first, order++,
+                            pairs, pending, i, j, alternative + 1});
+            }
+
+            const size_t k = choices[alternative].second;
+            if (k == j) {
+                pending = with_segment(std::move(pending), i, j - 1);
+            } else {
+                pairs = SharedList<std::pair<int, int>>::push(
+                    {int(k), int(j)}, std::move(pairs));
+                if (k > i) {
+                    pending = with_segment(std::move(pending), i, k - 1);
+                }
+                pending = with_segment(std::move(pending), k + 1, j - 1);
+            }
+
+            if (!pending) {
+                break;
+            }
+            std::tie(i, j) = pending->value;
+            pending = pending->next;
+            alternative = 0;
+        }
+
+        SuboptimalStructure structure{bound, {}};
+        for (const auto* node = pairs.get(); node; node = node->next.get()) {
+            structure.pairs.push_back(node->value);
+        }
+        std::sort(structure.pairs.begin(), structure.pairs.end());
+        co_yield std::move(structure);
+    }
+}
@@ -0,0 +1,384 @@
+/**
+ * @file thread_pool.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Persistent thread pool used by the parallel DP engines
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads that stay alive between calls, so that
+ * splitting every anti-diagonal of the DP matrix across cores does not pay
+ * for thread creation each time.
+ *
+ */
+class ThreadPool {
+   private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    std::mutex submit_mutex;
+
+    std::function<void(size_t, size_t)> task;
+    size_t range_begin = 0;
+    size_t range_end = 0;
+    size_t grain = 1;
+    std::atomic<size_t> next_index{0};
+    size_t busy_workers = 0;
+    std::uint64_t generation = 0;
+    bool stopping = false;
+
+    /**
+     * @brief Hands out chunks of the current range until none are left
+     *
+     */
+    void run_chunks() {
+        while (true) {
+            size_t begin = next_index.fetch_add(grain);
+            if (begin >= range_end) {
+                return;
+            }
+            task(begin, std::min(begin + grain, range_end));
+        }
+    }
+
+    /**
+     * @brief Body of every worker thread
+     *
+     */
+    void worker_loop() {
+        std::uint64_t seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                work_ready.wait(lock, [&] {
+                    return stopping || generation != seen_generation;
+                });
+                if (stopping) {
+                    return;
+                }
+                seen_generation = generation;
+            }
+
+            run_chunks();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy_workers == 0) {
+                work_done.notify_one();
+            }
+        }
+    }
+
+   public:
+    /**
+     * @brief Construct a new Thread Pool object. The calling thread takes
+     * part in every parallel_for, so thread_count - 1 threads are spawned.
+     *
+     * @param thread_count
+     */
+    explicit ThreadPool(size_t thread_count) {
+        thread_count = std::max<size_t>(thread_count, 1);
+        for (size_t index = 1; index < thread_count; index++) {
+            workers.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Destroy the Thread Pool object, joins all the workers
+     *
+     */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    /**
+     * @brief Number of threads taking part in a parallel_for
+     *
+     * @return size_t
+     */
+    size_t size() const { return workers.size() + 1; }
+
+    /**
+     * @brief Calls function(index) for every index in [begin, end) and
+     * returns once all of them finished. Calls coming from several threads are
+     * serialized; calling it from inside a task deadlocks.
+     *
+     * @tparam Function
+     * @param begin
+     * @param end
+     * @param function
+     */
+    template <typename Function>
+    void parallel_for(size_t begin, size_t end, Function function) {
+        if (begin >= end) {
+            return;
+        }
+        if (workers.empty() || end - begin == 1) {
+            for (size_t index = begin; index < end; index++) {
+                function(index);
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> submit_lock(submit_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = [&function](size_t chunk_begin, size_t chunk_end) {
+                for (size_t index = chunk_begin; index < chunk_end; index++) {
+                    function(index);
+                }
+            };
+            range_begin = begin;
+            range_end = end;
+            grain = std::max<size_t>(1, (end - begin) / (4 * size()));
+            next_index.store(begin);
+            busy_workers = workers.size();
+            generation++;
+        }
+        work_ready.notify_all();
+
+        run_chunks();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        work_done.wait(lock, [&] { return busy_workers == 0; });
+    }
+
+    /**
+     * @brief Process wide pool with the given number of threads, created on
+     * first use and kept alive until exit. 0 means one thread per core.
+     *
+     * @param thread_count
+     * @return ThreadPool&
+     */
+    static ThreadPool& shared(size_t thread_count = 0) {
+        if (thread_count == 0) {
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        static std::mutex pools_mutex;
+        static std::map<size_t, std::unique_ptr<ThreadPool>> pools;
+
+        std::lock_guard<std::mutex> lock(pools_mutex);
+        std::unique_ptr<ThreadPool>& pool = pools[thread_count];
+        if (!pool) {
+            pool = std::make_unique<ThreadPool>(thread_count);
+        }
+        return *pool;
+    }
+};
+
+/**
+ * @brief Thread pool in which every thread owns a queue of tasks. Tasks may
+ * spawn further tasks, which go to the back of the spawning thread's own
+ * queue; idle threads steal from the front of the other queues. This lets a
+ * dependency graph be run without a global barrier.
+ *
+ */
+class WorkStealingPool {
+   private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::mutex submit_mutex;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> pending{0};
+    bool stopping = false;
+
+    static inline thread_local WorkStealingPool* current_pool = nullptr;
+    static inline thread_local size_t current_index = 0;
+
+    /**
+     * @brief Pops a task from the own queue, or steals one from another
+     *
+     * @param index
+     * @param task
+     * @return true if a task was found
+     */
+    bool find_task(size_t index, std::function<void()>& task) {
+        for (size_t offset = 0; offset < queues.size(); offset++) {
+            TaskQueue& queue = *queues[(index + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (offset == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            } else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Runs tasks until the pool stops, or, for the thread inside
+     * run_all, until nothing is pending anymore
+     *
+     * @param index
+     * @param until_idle
+     */
+    void run(size_t index, bool until_idle) {
+        current_pool = this;
+        current_index = index;
+
+        std::function<void()> task;
+        while (true) {
+            if (find_task(index, task)) {
+                task();
+                task = nullptr;
+                if (--pending == 0) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    wake.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] {
+                return stopping || queued > 0 || (until_idle && pending == 0);
+            });
+            if (stopping || (until_idle && pending == 0)) {
+                break;
+            }
+        }
+
+        current_pool = nullptr;
+    }
+
+   public:
+    /**
+     * @brief Construct a new Work Stealing Pool object. As with ThreadPool the
+     * thread calling run_all takes part, so thread_count - 1 threads are
+     * spawned.
+     *
+     * @param thread_count
+     */
+    explicit WorkStealingPool(size_t thread_count) {
+        thread_count = std::max<size_t>(thread_count, 1);
+        for (size_t index = 0; index < thread_count; index++) {
+            queues.push_back(std::make_unique<TaskQueue>());
+        }
+        for (size_t index = 1; index < thread_count; index++) {
+            workers.emplace_back([this, index] { run(index, false); });
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    /**
+     * @brief Destroy the Work Stealing Pool object, joins all the workers
+     *
+     */
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    /**
+     * @brief Number of threads running tasks during run_all
+     *
+     * @return size_t
+     */
+    size_t size() const { return queues.size(); }
+
+    /**
+     * @brief Queues a task. From inside a task it goes to the running
+     * thread's own queue, from outside to the queue of the thread calling
+     * run_all.
+     *
+     * @param task
+     */
+    void spawn(std::function<void()> task) {
+        size_t index = current_pool == this ? current_index : 0;
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        queued++;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        wake.notify_one();
+    }
+
+    /**
+     * @brief Runs the spawned tasks, and whatever they spawn, on all threads
+     * and returns when none is left. Only one thread may use the pool at a
+     * time.
+     *
+     * @param initial_tasks
+     */
+    void run_all(std::vector<std::function<void()>> initial_tasks) {
+        std::lock_guard<std::mutex> submit_lock(submit_mutex);
+        for (std::function<void()>& task : initial_tasks) {
+            spawn(std::move(task));
+        }
+        run(0, true);
+    }
+
+    /**
+     * @brief Process wide pool with the given number of threads, created on
+     * first use and kept alive until exit. 0 means one thread per core.
+     *
+     * @param thread_count
+     * @return WorkStealingPool&
+     */
+    static WorkStealingPool& shared(size_t thread_count = 0) {
+        if (thread_count == 0) {
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        static std::mutex pools_mutex;
+        static std::map<size_t, std::unique_ptr<WorkStealingPool>> pools;
+
+        std::lock_guard<std::mutex> lock(pools_mutex);
+        std::unique_ptr<WorkStealingPool>& pool = pools[thread_count];
+        if (!pool) {
+            pool = std::make_unique<WorkStealingPool>(thread_count);
+        }
+        return *pool;
+    }
+};
@@ -0,0 +1,159 @@
+/**
+ * @file tiled_engine.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Cache-blocked DP fill scheduled as a dependency graph of tiles
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <vector>
+#include "rna_folding.hh"
+#include "thread_pool.hh"
+
+/**
+ * @brief Fills tile (I, J) of the DP matrix. For an off-diagonal tile the
+ * split points t whose two halves lie in already finished tiles are handled
+ * first as one max-plus product over whole rows; only the split points that
+ * fall inside the tile itself are left for the per cell pass.
+ *
+ * @tparam Cell
+ * @param dp
+ * @param columns transposed mirror of dp
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param tile_size
+ * @param tile_i
+ * @param tile_j
+ * @param steps if not null, the winning rule of every cell is recorded here
+ */
+template <typename Cell>
+inline void fill_tile(TriangularMatrix<Cell>& dp,
+                      ColumnTriangularMatrix<Cell>& columns,
+                      const Sequence& rna_sequence,
+                      const int& minimal_loop_length, size_t tile_size,
+                      size_t tile_i, size_t tile_j,
+                      TracebackMatrix* steps = nullptr) {
+    const size_t n = dp.size();
+    const size_t i_begin = tile_i * tile_size;
+    const size_t i_end = std::min(i_begin + tile_size, n);
+    const size_t j_begin = tile_j * tile_size;
+    const size_t j_end = std::min(j_begin + tile_size, n);
+
+    if (tile_i == tile_j) {
+        for (size_t i = i_end; i-- > i_begin;) {
+            for (size_t j = i + 1; j < j_end; j++) {
+                fill_cell(dp, columns, rna_sequence, minimal_loop_length, i,
+                          j, steps);
+            }
+        }
+        return;
+    }
+
+    const size_t width = j_end - j_begin;
+    thread_local std::vector<Cell> best;
+    best.assign((i_end - i_begin) * width, std::numeric_limits<Cell>::min());
+
+    // Split points i_end - 1 <= t < j_begin: (i, t) lies in a tile left of
+    // this one and (t + 1, j) in a tile below it
+    for (size_t i = i_begin; i < i_end; i++) {
+        const Cell* row = dp.row(i);
+        Cell* best_row = best.data() + (i - i_begin) * width;
+        for (size_t t = i_end - 1; t < j_begin; t++) {
+            max_plus_accumulate(best_row, row[t - i],
+                                dp.row(t + 1) + (j_begin - t - 1), width);
+        }
+    }
+
+    // Remaining split points lie inside this tile, so go bottom-up, left to
+    // right
+    for (size_t i = i_end; i-- > i_begin;) {
+        const Cell* row = dp.row(i);
+        for (size_t j = j_begin; j < j_end; j++) {
+            const Cell* column = columns.column(j);
+            Cell rc = std::max(
+                {best[(i - i_begin) * width + (j - j_begin)],
+                 max_plus(row, column + i + 1, i_end - 1 - i),
+                 max_plus(row + (j_begin - i), column + j_begin + 1,
+                          j - j_begin)});
+            finish_cell(dp, columns, rna_sequence, minimal_loop_length, i, j,
+                        rc, steps);
+        }
+    }
+}
+
+/**
+ * @brief Tiled version of create_matrix. The upper triangle is cut into
+ * square tiles of tile_size x tile_size cells. Tile (I, J) can start as soon
+ * as tiles (I, J - 1) and (I + 1, J) are done, so the tiles are run as a
+ * dependency graph on a work-stealing pool instead of diagonal by diagonal.
+ *
+ * @tparam Cell cell type, see with_cell_type for picking the narrowest one
+ * @param rna_sequence
+ * @param minimal_loop_length
+ * @param thread_count number of threads, 0 means one per core
+ * @param tile_size
+ * @param steps if not null, receives the winning rule of every cell
+ * @return TriangularMatrix<Cell>
+ */
+template <typename Cell = int>
+TriangularMatrix<Cell> create_matrix_tiled(const Sequence& rna_sequence,
+                                           const int& minimal_loop_length = 0,
+                                           size_t thread_count = 0,
+                                           size_t tile_size = 64,
+                                           TracebackMatrix* steps = nullptr) {
+    const size_t n = rna_sequence.size();
+    check_cell_type<Cell>(n);
+    TriangularMatrix<Cell> dp(n);
+    ColumnTriangularMatrix<Cell> columns(n);
+    if (steps != nullptr) {
+        *steps = TracebackMatrix(n);
+    }
+    if (n == 0) {
+        return dp;
+    }
+
+    tile_size = std::max<size_t>(tile_size, 1);
+    const size_t tiles = (n + tile_size - 1) / tile_size;
+
+    // Unfinished dependencies of tile (I, J), stored at I * tiles + J
+    std::vector<std::atomic<int>> dependencies(tiles * tiles);
+    for (size_t tile_i = 0; tile_i < tiles; tile_i++) {
+        for (size_t tile_j = tile_i; tile_j < tiles; tile_j++) {
+            dependencies[tile_i * tiles + tile_j] = tile_i == tile_j ? 0 : 2;
+        }
+    }
+
+    WorkStealingPool& pool = WorkStealingPool::shared(thread_count);
+
+    std::function<void(size_t, size_t)> run_tile = [&](size_t tile_i,
+                                                       size_t tile_j) {
+        fill_tile(dp, columns, rna_sequence, minimal_loop_length, tile_size,
+                  tile_i, tile_j, steps);
+        if (tile_i > 0 &&
+            --dependencies[(tile_i - 1) * tiles + tile_j] == 0) {
+            pool.spawn([&run_tile, tile_i, tile_j] {
+                run_tile(tile_i - 1, tile_j);
+            });
+        }
+        if (tile_j + 1 < tiles &&
+            --dependencies[tile_i * tiles + tile_j + 1] == 0) {
+            pool.spawn([&run_tile, tile_i, tile_j] {
+                run_tile(tile_i, tile_j + 1);
+            });
+        }
+    };
+
+    std::vector<std::function<void()>> diagonal_tiles;
+    for (size_t tile = 0; tile < tiles; tile++) {
+        diagonal_tiles.push_back([&run_tile, tile] { run_tile(tile, tile); });
+    }
+    pool.run_all(std::move(diagonal_tiles));
+
+    return dp;
+}
@@ -0,0 +1,180 @@
+/**
+ * @file triangular_matrix.hh
+ * @author Adarsh Das (saphereye.github.io)
+ * @brief Packed upper-triangular matrix used as the DP table
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Square matrix of which only the cells with i <= j are stored. The
+ * cells live in one contiguous allocation, row after row, so that row i holds
+ * the columns i..n-1 next to each other.
+ *
+ * @tparam Cell type of a single cell
+ */
+template <typename Cell = int>
+class TriangularMatrix {
+   private:
+    size_t n;
+    std::vector<Cell> cells;
+
+   public:
+    /**
+     * @brief Construct an empty matrix
+     *
+     */
+    TriangularMatrix() : n(0) {}
+
+    /**
+     * @brief Construct a new n x n matrix with every cell set to zero
+     *
+     * @param n
+     */
+    explicit TriangularMatrix(size_t n) : n(n), cells(n * (n + 1) / 2, 0) {}
+
+    /**
+     * @brief Position of cell (i, j) inside the packed storage, requires i <= j
+     *
+     * @param i
+     * @param j
+     * @return size_t
+     */
+    size_t index(size_t i, size_t j) const {
+        return i * (2 * n - i + 1) / 2 + (j - i);
+    }
+
+    /**
+     * @brief Access cell (i, j), requires i <= j
+     *
+     * @param i
+     * @param j
+     * @return Cell&
+     */
+    Cell& operator()(size_t i, size_t j) { return cells[index(i, j)]; }
+
+    /**
+     * @brief Access cell (i, j), requires i <= j
+     *
+     * @param i
+     * @param j
+     * @return const Cell&
+     */
+    const Cell& operator()(size_t i, size_t j) const {
+        return cells[index(i, j)];
+    }
+
+    /**
+     * @brief Read cell (i, j). Cells below the diagonal are not stored and
+     * read as zero, which is what the recurrence expects for empty substrings.
+     *
+     * @param i
+     * @param j
+     * @return Cell
+     */
+    Cell at(size_t i, size_t j) const {
+        return i > j ? Cell(0) : cells[index(i, j)];
+    }
+
+    /**
+     * @brief Pointer to cell (i, i), the columns i..n-1 of row i follow it
+     *
+     * @param i
+     * @return const Cell*
+     */
+    const Cell* row(size_t i) const { return cells.data() + index(i, i); }
+
+    /**
+     * @brief Number of rows (and columns) of the matrix
+     *
+     * @return size_t
+     */
+    size_t size() const { return n; }
+
+    /**
+     * @brief Number of cells actually stored
+     *
+     * @return size_t
+     */
+    size_t cell_count() const { return cells.size(); }
+};
+
+/**
+ * @brief Same cells as TriangularMatrix, but stored column after column so
+ * that column j holds the rows 0..j next to each other. Kept next to the DP
+ * matrix as a transposed mirror, which makes both operands of the
+ * bifurcation rule contiguous.
+ *
+ * @tparam Cell type of a single cell
+ */
+template <typename Cell = int>
+class ColumnTriangularMatrix {
+   private:
+    size_t n;
+    std::vector<Cell> cells;
+
+   public:
+    /**
+     * @brief Construct an empty matrix
+     *
+     */
+    ColumnTriangularMatrix() : n(0) {}
+
+    /**
+     * @brief Construct a new n x n matrix with every cell set to zero
+     *
+     * @param n
+     */
+    explicit ColumnTriangularMatrix(size_t n)
+        : n(n), cells(n * (n + 1) / 2, 0) {}
+
+    /**
+     * @brief Position of cell (i, j) inside the packed storage, requires i <= j
+     *
+     * @param i
+     * @param j
+     * @return size_t
+     */
+    size_t index(size_t i, size_t j) const { return j * (j + 1) / 2 + i; }
+
+    /**
+     * @brief Access cell (i, j), requires i <= j
+     *
+     * @param i
+     * @param j
+     * @return Cell&
+     */
+    Cell& operator()(size_t i, size_t j) { return cells[index(i, j)]; }
+
+    /**
+     * @brief Access cell (i, j), requires i <= j
+     *
+     * @param i
+     * @param j
+     * @return const Cell&
+     */
+    const Cell& operator()(size_t i, size_t j) const {
+        return cells[index(i, j)];
+    }
+
+    /**
+     * @brief Pointer to cell (0, j), the rows 0..j of column j follow it
+     *
+     * @param j
+     * @return const Cell*
+     */
+    const Cell* column(size_t j) const { return cells.data() + index(0, j); }
+
+    /**
+     * @brief Number of rows (and columns) of the matrix
+     *
+     * @return size_t
+     */
+    size_t size() const { return n; }
+};